@@ -0,0 +1,203 @@
+#!/bin/bash
+#
+# run-bench.sh
+#
+# Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+#
+# This file is part of Http Server.
+#
+# Http Server is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published
+# by the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# Http Server is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+#
+# End-to-end benchmark: serves a generated corpus with myhttpdp and
+# myhttpdt on loopback, sweeps loadgen over HTTP version, concurrency and
+# file size, and compares the result against a stored baseline.
+#
+# Usage: run-bench.sh <bindir> <outdir> [<baseline.csv>]
+#
+# Environment:
+#   BENCH_SERVERS      servers to run (default "myhttpdp myhttpdt")
+#   BENCH_MODES        HTTP versions (default "1.0 1.1")
+#   BENCH_CONCURRENCY  loadgen thread counts (default "1 4 16")
+#   BENCH_SIZES        corpus files (default "tiny 4k 64k 1m 100m")
+#   BENCH_REQUESTS     requests per run (default scaled by file size)
+#   BENCH_PORT         loopback port (default 18080)
+#   BENCH_THRESHOLD    allowed req/s drop in percent (default 10)
+
+set -e
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 <bindir> <outdir> [<baseline.csv>]" >&2
+  exit 2
+fi
+
+bindir=$(cd "$1" && pwd)
+mkdir -p "$2"
+outdir=$(cd "$2" && pwd)
+baseline=$3
+
+servers=${BENCH_SERVERS:-"myhttpdp myhttpdt"}
+modes=${BENCH_MODES:-"1.0 1.1"}
+concurrency=${BENCH_CONCURRENCY:-"1 4 16"}
+sizes=${BENCH_SIZES:-"tiny 4k 64k 1m 100m"}
+port=${BENCH_PORT:-18080}
+threshold=${BENCH_THRESHOLD:-10}
+
+workdir=$(mktemp -d "${TMPDIR:-/tmp}/myhttpd-bench.XXXXXX")
+server_pid=
+cleanup() {
+  stop_server
+  rm -rf "$workdir"
+}
+trap cleanup EXIT INT TERM
+
+size_bytes() {
+  case $1 in
+    tiny) echo 13 ;;
+    4k) echo 4096 ;;
+    64k) echo 65536 ;;
+    1m) echo 1048576 ;;
+    100m) echo 104857600 ;;
+    *) echo "unknown size: $1" >&2; exit 2 ;;
+  esac
+}
+
+# total requests per run, scaled down for the large files
+size_requests() {
+  if [ -n "$BENCH_REQUESTS" ]; then
+    echo "$BENCH_REQUESTS"
+    return
+  fi
+  case $1 in
+    tiny|4k) echo 400 ;;
+    64k) echo 200 ;;
+    1m) echo 32 ;;
+    100m) echo 2 ;;
+  esac
+}
+
+now_ns() {
+  date +%s%N
+}
+
+start_server() {
+  (cd "$workdir" && exec "$bindir/$1" "$2" "$port" 5 >/dev/null) &
+  server_pid=$!
+  tries=0
+  until (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; do
+    tries=$((tries + 1))
+    if [ $tries -gt 100 ]; then
+      echo "$1 did not start listening on port $port" >&2
+      exit 1
+    fi
+    sleep 0.05
+  done
+}
+
+stop_server() {
+  if [ -n "$server_pid" ]; then
+    pkill -P "$server_pid" 2>/dev/null || true
+    kill "$server_pid" 2>/dev/null || true
+    wait "$server_pid" 2>/dev/null || true
+    server_pid=
+  fi
+}
+
+# deterministic corpus: the same bytes on every run and every machine
+mkdir -p "$workdir/myhttpd-root"
+for size in $sizes; do
+  yes "myhttpd benchmark corpus" | head -c "$(size_bytes $size)" \
+    > "$workdir/myhttpd-root/$size.bin"
+done
+
+csv="$outdir/bench.csv"
+json="$outdir/bench.json"
+echo "server,http,concurrency,size,requests,elapsed_us,requests_per_s,connect_us,throughput_Bps,ttfb_us,transfer_us" \
+  > "$csv"
+
+for server in $servers; do
+  for mode in $modes; do
+    start_server "$server" "$mode"
+    for c in $concurrency; do
+      for size in $sizes; do
+        per_thread=$(( $(size_requests $size) / c ))
+        [ $per_thread -gt 0 ] || per_thread=1
+        requests=$((per_thread * c))
+
+        begin=$(now_ns)
+        result=$(cd "$workdir" && "$bindir/loadgen" "$mode" 127.0.0.1 \
+                   "$port" "/$size.bin" "$per_thread" "$c")
+        end=$(now_ns)
+        elapsed_us=$(( (end - begin) / 1000 ))
+        [ $elapsed_us -gt 0 ] || elapsed_us=1
+
+        set -- $result
+        echo "$server,$mode,$c,$size,$requests,$elapsed_us,$((requests * 1000000 / elapsed_us)),$1,$2,$3,$4" \
+          >> "$csv"
+        printf '%-9s HTTP/%s c=%-3s %-5s %8d req/s\n' "$server" "$mode" \
+          "$c" "$size" "$((requests * 1000000 / elapsed_us))"
+      done
+    done
+    stop_server
+  done
+done
+
+awk -F, '
+  NR == 1 { for (i = 1; i <= NF; ++i) name[i] = $i; print "["; next }
+  {
+    if (NR > 2) print ",";
+    printf "  {";
+    for (i = 1; i <= NF; ++i) {
+      separator = (i > 1 ? ", " : "");
+      if (i == 1 || i == 2 || i == 4)
+        printf "%s\"%s\": \"%s\"", separator, name[i], $i;
+      else
+        printf "%s\"%s\": %s", separator, name[i], $i;
+    }
+    printf "}";
+  }
+  END { print ""; print "]" }
+' "$csv" > "$json"
+
+echo "Report: $csv $json"
+
+if [ -z "$baseline" ] || [ ! -f "$baseline" ]; then
+  echo "No baseline to compare against; run 'make bench-baseline' to store one."
+  exit 0
+fi
+
+set -o pipefail
+awk -F, -v threshold="$threshold" '
+  FNR == 1 { next }
+  NR == FNR { base[$1 "," $2 "," $3 "," $4] = $7; next }
+  {
+    key = $1 "," $2 "," $3 "," $4;
+    if (!(key in base) || base[key] == 0)
+      next;
+    change = ($7 - base[key]) * 100.0 / base[key];
+    status = "ok";
+    if (change < -threshold) {
+      status = "REGRESSION";
+      ++regressions;
+    }
+    printf "%-40s %10d -> %10d req/s %+7.1f%% %s\n", key, base[key], $7,
+           change, status;
+  }
+  END {
+    if (regressions) {
+      printf "%d configuration(s) regressed by more than %s%%\n",
+             regressions, threshold;
+      exit 1;
+    }
+  }
+' "$baseline" "$csv" | tee "$outdir/bench-compare.txt"
@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# make-test-cert.sh
+#
+# Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+#
+# This file is part of Http Server.
+#
+# Http Server is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published
+# by the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# Http Server is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+#
+# Generates a self-signed certificate for localhost for trying out TLS:
+#
+#   scripts/make-test-cert.sh [outdir]
+#   src/myhttpdt 1.1 8443 30 --tls-cert=test-cert.pem --tls-key=test-key.pem
+#   curl --cacert test-cert.pem https://localhost:8443/
+
+set -e
+
+outdir=${1:-.}
+mkdir -p "$outdir"
+
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \
+  -days 365 -subj "/CN=localhost" \
+  -addext "subjectAltName=DNS:localhost,IP:127.0.0.1" \
+  -keyout "$outdir/test-key.pem" -out "$outdir/test-cert.pem" 2>/dev/null
+
+echo "wrote $outdir/test-cert.pem and $outdir/test-key.pem"
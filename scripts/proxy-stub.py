@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+#
+# proxy-stub.py
+#
+# Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+#
+# This file is part of Http Server.
+#
+# Http Server is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published
+# by the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# Http Server is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+#
+# A stand-in upstream for trying out --proxy:
+#
+#   scripts/proxy-stub.py [port]
+#   src/myhttpdt 1.1 8080 30 --proxy=/api=127.0.0.1:8097 --proxy-cache-ms=0
+#   curl http://localhost:8080/api/slow
+#
+# Paths, all under any prefix:
+#   /slow     answers after half a second, numbered, so coalesced requests
+#             show the same number
+#   /hits     how many requests reached the stub, never shared
+#   /chunked  a chunked response
+#   /big      a 4 MB response, larger than the default capture
+#   /echo     the request body, Content-Length or chunked
+#   /whoami   the Cookie and Authorization headers sent
+#   /vary     varies on Accept-Language and echoes it
+
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+hits = 0
+hits_lock = threading.Lock()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, format, *args):
+        pass
+
+    def read_body(self):
+        if 'chunked' in self.headers.get('Transfer-Encoding', '').lower():
+            body = b''
+            while True:
+                size = int(self.rfile.readline().split(b';')[0], 16)
+                if size == 0:
+                    while self.rfile.readline() not in (b'\r\n', b''):
+                        pass
+                    return body
+                body += self.rfile.read(size)
+                self.rfile.readline()
+        return self.rfile.read(int(self.headers.get('Content-Length', 0)))
+
+    def answer(self, body, headers=()):
+        self.send_response(200)
+        self.send_header('Content-Length', str(len(body)))
+        for name, value in headers:
+            self.send_header(name, value)
+        self.end_headers()
+        if self.command != 'HEAD':
+            self.wfile.write(body)
+
+    def do_GET(self):
+        global hits
+        with hits_lock:
+            hits += 1
+            count = hits
+        body = self.read_body()
+        path = self.path.split('?')[0]
+
+        if path.endswith('/slow'):
+            time.sleep(0.5)
+            self.answer(b'slow response %d\n' % count)
+        elif path.endswith('/hits'):
+            self.answer(b'%d\n' % count, [('Cache-Control', 'no-store')])
+        elif path.endswith('/chunked'):
+            self.send_response(200)
+            self.send_header('Transfer-Encoding', 'chunked')
+            self.end_headers()
+            self.wfile.write(b'6\r\nhello \r\n6\r\nworld\n\r\n0\r\n\r\n')
+        elif path.endswith('/big'):
+            self.answer(b'x' * (4 << 20))
+        elif path.endswith('/echo'):
+            self.answer(body)
+        elif path.endswith('/whoami'):
+            self.answer(('cookie=%s authorization=%s\n' % (
+                self.headers.get('Cookie'),
+                self.headers.get('Authorization'))).encode())
+        elif path.endswith('/vary'):
+            self.answer(('%s\n' % self.headers.get('Accept-Language')).encode(),
+                        [('Vary', 'Accept-Language')])
+        else:
+            self.send_error(404)
+
+    do_HEAD = do_GET
+    do_POST = do_GET
+    do_PUT = do_GET
+
+
+if __name__ == '__main__':
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 8097
+    ThreadingHTTPServer(('127.0.0.1', port), Handler).serve_forever()
@@ -0,0 +1,143 @@
+/*
+ * admission.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <algorithm>
+#include <exception>
+
+#include "admission.hpp"
+
+#define RATE_LIMITER_SLOTS 65536
+#define RATE_LIMITER_PROBES 32
+
+namespace {
+
+long long NowMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+uint32_t Hash(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
+}
+
+AdmissionControl::AdmissionControl(long target_us, long interval_us)
+    : target_us(target_us), interval_us(interval_us), interval_end(0),
+      min_sojourn_us(0), overloaded(false) {
+  pthread_mutex_init(&mutex, NULL);
+}
+
+AdmissionControl::~AdmissionControl() {
+  pthread_mutex_destroy(&mutex);
+}
+
+bool AdmissionControl::ShouldShed(long sojourn_us) {
+  long long now = NowMicros();
+
+  pthread_mutex_lock(&mutex);
+  if (interval_end == 0) {
+    interval_end = now + interval_us;
+    min_sojourn_us = sojourn_us;
+  } else if (now >= interval_end) {
+    overloaded = min_sojourn_us > target_us;
+    interval_end = now + interval_us;
+    min_sojourn_us = sojourn_us;
+  } else {
+    min_sojourn_us = std::min(min_sojourn_us, sojourn_us);
+  }
+  bool shed = overloaded && sojourn_us > target_us;
+  pthread_mutex_unlock(&mutex);
+
+  return shed;
+}
+
+ClientRateLimiter::ClientRateLimiter(long rate, long burst)
+    : rate(rate), burst(burst) {
+  void* p = mmap(NULL, RATE_LIMITER_SLOTS * sizeof(Slot),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    perror("mmap");
+    throw std::exception();
+  }
+  slots = (Slot*)p;
+}
+
+ClientRateLimiter::~ClientRateLimiter() {
+  munmap(slots, RATE_LIMITER_SLOTS * sizeof(Slot));
+}
+
+bool ClientRateLimiter::Allow(uint32_t address) {
+  // 0.0.0.0 never connects, so it marks an empty slot
+  if (address == 0)
+    return true;
+
+  uint32_t now_ms = (uint32_t)(NowMicros() / 1000);
+  uint64_t full = (uint64_t)burst * 1000;
+
+  uint32_t index = Hash(address) % RATE_LIMITER_SLOTS;
+  for (int probe = 0; probe < RATE_LIMITER_PROBES; ++probe) {
+    Slot* slot = &slots[(index + probe) % RATE_LIMITER_SLOTS];
+    uint32_t owner = slot->address;
+    if (owner == 0) {
+      if (!__sync_bool_compare_and_swap(&slot->address, 0, address) &&
+          slot->address != address)
+        continue;
+      owner = address;
+    }
+    if (owner != address)
+      continue;
+
+    while (true) {
+      uint64_t state = slot->state;
+      uint64_t tokens;
+      if (state == 0) {
+        // a fresh bucket starts full
+        tokens = full;
+      } else {
+        uint32_t elapsed_ms = now_ms - (uint32_t)(state >> 32);
+        tokens = (state & 0xffffffffULL) + (uint64_t)elapsed_ms * rate;
+        tokens = std::min(tokens, full);
+      }
+
+      bool allowed = tokens >= 1000;
+      if (allowed)
+        tokens -= 1000;
+      uint64_t next = ((uint64_t)now_ms << 32) | tokens;
+      if (next == 0)
+        next = 1;
+      if (__sync_bool_compare_and_swap(&slot->state, state, next))
+        return allowed;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,73 @@
+/*
+ * admission.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ADMISSION_HPP_
+#define ADMISSION_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+
+// CoDel-style overload detector on the delay between a connection's
+// arrival and the start of its processing.  Once the minimum delay over a
+// whole interval exceeds the target the server is considered overloaded
+// and everything that waited longer than the target is shed; otherwise
+// nothing is.
+class AdmissionControl {
+ public:
+  AdmissionControl(long target_us, long interval_us);
+  ~AdmissionControl();
+
+  bool ShouldShed(long sojourn_us);
+
+ private:
+  pthread_mutex_t mutex;
+  long target_us;
+  long interval_us;
+  long long interval_end;
+  long min_sojourn_us;
+  bool overloaded;
+};
+
+// Per-client IPv4 token buckets in a fixed-size open-addressing table.
+// Slots are claimed and updated with compare-and-swap only, and the table
+// lives in a shared mapping so forked workers draw from the same buckets.
+// When the table is full new clients are admitted unlimited.
+class ClientRateLimiter {
+ public:
+  ClientRateLimiter(long rate, long burst);
+  ~ClientRateLimiter();
+
+  bool Allow(uint32_t address);
+
+ private:
+  struct Slot {
+    uint32_t address;
+    uint32_t padding;
+    // last refill time in ms (high half) and milli-tokens (low half)
+    uint64_t state;
+  };
+
+  Slot* slots;
+  long rate;
+  long burst;
+};
+
+#endif
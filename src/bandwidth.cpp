@@ -0,0 +1,151 @@
+/*
+ * bandwidth.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "bandwidth.hpp"
+
+#define DEFAULT_SEND_QUANTUM 65536
+
+namespace {
+
+uint64_t NowMicros() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+uint64_t CostMicros(size_t length, long rate) {
+  return (uint64_t)length * 1000000 / rate;
+}
+
+// How long to wait before |tat| may advance to |next|: none while it stays
+// within the burst, nor for a response's first quantum while the bucket
+// itself is, so that overdraft is bounded by one quantum.
+uint64_t WaitMicros(uint64_t tat, uint64_t next, uint64_t now,
+                    uint64_t burst, bool first) {
+  if (next <= now + burst || (first && tat <= now + burst))
+    return 0;
+  return next - now - burst;
+}
+
+}
+
+BandwidthLimiter::BandwidthLimiter(long global_rate, long connection_rate,
+                                   long quantum)
+    : global_tat(NULL), global_rate(global_rate),
+      connection_rate(connection_rate),
+      quantum(quantum > 0 ? quantum : DEFAULT_SEND_QUANTUM) {
+  if (global_rate <= 0)
+    return;
+  void* p = mmap(NULL, sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    perror("mmap");
+    throw std::exception();
+  }
+  global_tat = (uint64_t*)p;
+}
+
+BandwidthLimiter::~BandwidthLimiter() {
+  if (global_tat != NULL)
+    munmap(global_tat, sizeof(uint64_t));
+}
+
+long BandwidthLimiter::Quantum() const {
+  return quantum;
+}
+
+bool BandwidthLimiter::Limited() const {
+  return global_rate > 0 || connection_rate > 0;
+}
+
+long BandwidthLimiter::Book(uint64_t* connection_tat, size_t length,
+                            bool first) {
+  uint64_t now = NowMicros();
+
+  // the bucket holds a quantum: booking may run that far ahead of now
+  uint64_t connection_next = 0;
+  if (connection_rate > 0) {
+    uint64_t burst = CostMicros(quantum, connection_rate);
+    connection_next = std::max(*connection_tat, now) +
+        CostMicros(length, connection_rate);
+    uint64_t wait = WaitMicros(*connection_tat, connection_next, now, burst,
+                               first);
+    if (wait > 0)
+      return wait;
+  }
+
+  if (global_rate > 0) {
+    uint64_t burst = CostMicros(quantum, global_rate);
+    while (true) {
+      uint64_t tat = *global_tat;
+      uint64_t next = std::max(tat, now) + CostMicros(length, global_rate);
+      uint64_t wait = WaitMicros(tat, next, now, burst, first);
+      if (wait > 0)
+        return wait;
+      if (__sync_bool_compare_and_swap(global_tat, tat, next))
+        break;
+    }
+  }
+
+  if (connection_rate > 0)
+    *connection_tat = connection_next;
+  return 0;
+}
+
+SendPacer::SendPacer(BandwidthLimiter* limiter)
+    : limiter(limiter), connection_tat(0) {
+}
+
+size_t SendPacer::Quantum() const {
+  return limiter != NULL ? limiter->Quantum() : DEFAULT_SEND_QUANTUM;
+}
+
+bool SendPacer::Limited() const {
+  return limiter != NULL && limiter->Limited();
+}
+
+size_t SendPacer::Grant(size_t want, bool first, long* wait_us) {
+  want = std::min(want, Quantum());
+  *wait_us = 0;
+  if (!Limited())
+    return want;
+  *wait_us = limiter->Book(&connection_tat, want, first);
+  return *wait_us == 0 ? want : 0;
+}
+
+size_t SendPacer::Acquire(size_t want, bool first) {
+  long wait_us;
+  size_t granted;
+  while ((granted = Grant(want, first, &wait_us)) == 0 && wait_us > 0) {
+    timespec delay;
+    delay.tv_sec = wait_us / 1000000;
+    delay.tv_nsec = wait_us % 1000000 * 1000;
+    nanosleep(&delay, NULL);
+  }
+  return granted;
+}
@@ -0,0 +1,78 @@
+/*
+ * bandwidth.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BANDWIDTH_HPP_
+#define BANDWIDTH_HPP_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Byte rate caps on response bodies: one global, kept in a shared mapping
+// so forked workers draw from it together, and one per connection.  Each
+// is a GCRA bucket (a theoretical arrival time) with a burst of one
+// quantum, updated with compare-and-swap.  Senders book at most a quantum
+// at a time and book again once the time they would wait is up, so
+// concurrent bulk transfers take turns a quantum each.  The first quantum
+// of a response skips the wait while the bucket is within its burst:
+// small responses go out at once when there is headroom, and wait like
+// any other booking when there is not.
+class BandwidthLimiter {
+ public:
+  // Rates are in bytes per second, 0 for no cap.
+  BandwidthLimiter(long global_rate, long connection_rate, long quantum);
+  ~BandwidthLimiter();
+
+  long Quantum() const;
+  bool Limited() const;
+
+  // Books |length| bytes against the global bucket and the connection's
+  // |*connection_tat|.  Returns 0 once booked, or how many microseconds
+  // to wait before asking again.  |first| may overdraw the burst by a
+  // quantum, unless the bucket is already past it.
+  long Book(uint64_t* connection_tat, size_t length, bool first);
+
+ private:
+  uint64_t* global_tat;
+  long global_rate;
+  long connection_rate;
+  long quantum;
+};
+
+// One connection's share of a BandwidthLimiter, which may be NULL.
+class SendPacer {
+ public:
+  explicit SendPacer(BandwidthLimiter* limiter);
+
+  size_t Quantum() const;
+  bool Limited() const;
+
+  // How many of |want| bytes may be sent now, at most a quantum; 0 with
+  // |*wait_us| set if none.
+  size_t Grant(size_t want, bool first, long* wait_us);
+  // As Grant, but sleeps until the bytes may be sent.
+  size_t Acquire(size_t want, bool first);
+
+ private:
+  BandwidthLimiter* limiter;
+  uint64_t connection_tat;
+};
+
+#endif
@@ -0,0 +1,393 @@
+/*
+ * content_cache.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <climits>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <string>
+
+#include "content_cache.hpp"
+
+#define CONTENT_CACHE_PAGE_SIZE (1 << 20)
+#define CONTENT_CACHE_MIN_CHUNK 256
+// chunk numbers are a page number times this plus the index in the page
+#define CONTENT_CACHE_PAGE_CHUNKS (CONTENT_CACHE_PAGE_SIZE / \
+                                   CONTENT_CACHE_MIN_CHUNK)
+#define CONTENT_CACHE_PROBES 32
+
+#define SLOT_EMPTY 0
+#define SLOT_USED 1
+#define SLOT_DELETED 2
+
+namespace {
+
+uint64_t HashPath(const std::string& path) {
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < path.length(); ++i) {
+    hash ^= (unsigned char)path[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+uint64_t NowMillis() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int64_t MtimeNanos(const struct stat& statbuf) {
+  return (int64_t)statbuf.st_mtim.tv_sec * 1000000000 +
+      statbuf.st_mtim.tv_nsec;
+}
+
+size_t Align(size_t n, size_t alignment) {
+  return (n + alignment - 1) / alignment * alignment;
+}
+
+}
+
+ContentCache::ContentCache(size_t bytes, long revalidate_ms)
+    : revalidate_ms(revalidate_ms) {
+  uint32_t num_pages = std::max((size_t)1, bytes / CONTENT_CACHE_PAGE_SIZE);
+  uint32_t num_slots = 1024;
+  while (num_slots < num_pages * (CONTENT_CACHE_PAGE_SIZE / 4096))
+    num_slots *= 2;
+
+  size_t pages_offset = Align(sizeof(Header) + num_slots * sizeof(Slot) +
+                              num_pages, 4096);
+  size = pages_offset + (size_t)num_pages * CONTENT_CACHE_PAGE_SIZE;
+  fd = memfd_create("myhttpd-content-cache", MFD_CLOEXEC);
+  if (fd == -1 || ftruncate(fd, size) == -1) {
+    perror("memfd_create");
+    throw std::exception();
+  }
+  base = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    perror("mmap");
+    throw std::exception();
+  }
+
+  header = (Header*)base;
+  slots = (Slot*)(base + sizeof(Header));
+  page_classes = (uint8_t*)(slots + num_slots);
+  pages = base + pages_offset;
+
+  header->num_slots = num_slots;
+  header->num_pages = num_pages;
+  uint32_t chunk_size = CONTENT_CACHE_MIN_CHUNK;
+  for (int i = 0; i < CONTENT_CACHE_CLASSES; ++i) {
+    header->classes[i].chunk_size = chunk_size;
+    chunk_size *= 2;
+  }
+}
+
+ContentCache::~ContentCache() {
+  munmap(base, size);
+  close(fd);
+}
+
+size_t ContentCache::MaxBodySize() const {
+  return CONTENT_CACHE_PAGE_SIZE - offsetof(Chunk, data) - PATH_MAX;
+}
+
+ContentCache::Chunk* ContentCache::GetChunk(uint32_t number) const {
+  uint32_t page = number / CONTENT_CACHE_PAGE_CHUNKS;
+  uint32_t index = number % CONTENT_CACHE_PAGE_CHUNKS;
+  const SizeClass& size_class = header->classes[page_classes[page] - 1];
+  return (Chunk*)(pages + (size_t)page * CONTENT_CACHE_PAGE_SIZE +
+                  (size_t)index * size_class.chunk_size);
+}
+
+ContentCache::Slot* ContentCache::FindSlot(uint64_t hash,
+                                           const std::string& path) const {
+  uint32_t mask = header->num_slots - 1;
+  for (uint32_t probe = 0; probe < CONTENT_CACHE_PROBES; ++probe) {
+    Slot* slot = &slots[(hash + probe) & mask];
+    if (slot->state == SLOT_EMPTY)
+      return NULL;
+    if (slot->state == SLOT_USED && slot->hash == hash &&
+        slot->key_length == path.length() &&
+        memcmp(GetChunk(slot->chunk)->data, path.data(), path.length()) == 0)
+      return slot;
+  }
+  return NULL;
+}
+
+bool ContentCache::Lookup(const std::string& path, std::string* body) {
+  uint64_t hash = HashPath(path);
+  uint32_t mask = header->num_slots - 1;
+  for (uint32_t probe = 0; probe < CONTENT_CACHE_PROBES; ++probe) {
+    Slot* slot = &slots[(hash + probe) & mask];
+    uint32_t seq = slot->seq;
+    __sync_synchronize();
+    if (seq & 1)
+      break;
+    uint8_t state = slot->state;
+    if (state == SLOT_EMPTY)
+      break;
+    if (state != SLOT_USED || slot->hash != hash ||
+        slot->key_length != path.length())
+      continue;
+
+    // a torn read is caught by the sequence check, but must not send the
+    // copy outside the segment first
+    uint64_t number = slot->chunk;
+    uint64_t length = slot->length;
+    uint64_t device = slot->device;
+    uint64_t inode = slot->inode;
+    int64_t mtime_ns = slot->mtime_ns;
+    uint64_t validated_ms = slot->validated_ms;
+    uint64_t page = number / CONTENT_CACHE_PAGE_CHUNKS;
+    uint64_t index = number % CONTENT_CACHE_PAGE_CHUNKS;
+    uint8_t page_class = page < header->num_pages ? page_classes[page] : 0;
+    if (page_class == 0 || page_class > CONTENT_CACHE_CLASSES)
+      break;
+    size_t chunk_size = header->classes[page_class - 1].chunk_size;
+    if ((index + 1) * chunk_size > CONTENT_CACHE_PAGE_SIZE ||
+        offsetof(Chunk, data) + path.length() + length > chunk_size)
+      break;
+    const Chunk* chunk = (const Chunk*)(pages +
+                                        page * CONTENT_CACHE_PAGE_SIZE +
+                                        index * chunk_size);
+    bool same = memcmp(chunk->data, path.data(), path.length()) == 0;
+    body->assign(chunk->data + path.length(), length);
+    __sync_synchronize();
+    if (slot->seq != seq)
+      break;
+    if (!same)
+      continue;
+
+    uint64_t now_ms = NowMillis();
+    if (now_ms - validated_ms > (uint64_t)revalidate_ms) {
+      struct stat statbuf;
+      if (stat(path.c_str(), &statbuf) == -1 ||
+          (uint64_t)statbuf.st_dev != device ||
+          (uint64_t)statbuf.st_ino != inode ||
+          (uint64_t)statbuf.st_size != length ||
+          MtimeNanos(statbuf) != mtime_ns)
+        break;
+      slot->validated_ms = now_ms;
+    }
+    slot->referenced = 1;
+    __sync_fetch_and_add(&header->hits, 1);
+    return true;
+  }
+  __sync_fetch_and_add(&header->misses, 1);
+  return false;
+}
+
+void ContentCache::Store(const std::string& path, const struct stat& statbuf,
+                         const char* data, size_t length) {
+  if (length > MaxBodySize() || path.length() > PATH_MAX)
+    return;
+  size_t needed = offsetof(Chunk, data) + path.length() + length;
+  int size_class = 0;
+  while (header->classes[size_class].chunk_size < needed)
+    ++size_class;
+
+  // another worker is storing; this one can be cached next time
+  if (!__sync_bool_compare_and_swap(&header->lock, 0, 1))
+    return;
+
+  uint64_t hash = HashPath(path);
+  Slot* existing = FindSlot(hash, path);
+  if (existing != NULL)
+    Evict(existing - slots);
+
+  uint32_t number = AllocateChunk(size_class);
+  Slot* slot = NULL;
+  if (number != 0) {
+    uint32_t mask = header->num_slots - 1;
+    for (uint32_t probe = 0; probe < CONTENT_CACHE_PROBES; ++probe) {
+      Slot* candidate = &slots[(hash + probe) & mask];
+      if (candidate->state != SLOT_USED) {
+        slot = candidate;
+        break;
+      }
+    }
+  }
+
+  if (slot != NULL) {
+    --number;
+    Chunk* chunk = GetChunk(number);
+    __sync_fetch_and_add(&slot->seq, 1);
+    __sync_synchronize();
+    chunk->owner = slot - slots + 1;
+    memcpy(chunk->data, path.data(), path.length());
+    memcpy(chunk->data + path.length(), data, length);
+    slot->hash = hash;
+    slot->key_length = path.length();
+    slot->chunk = number;
+    slot->length = length;
+    slot->device = statbuf.st_dev;
+    slot->inode = statbuf.st_ino;
+    slot->mtime_ns = MtimeNanos(statbuf);
+    slot->validated_ms = NowMillis();
+    slot->referenced = 0;
+    slot->state = SLOT_USED;
+    __sync_synchronize();
+    __sync_fetch_and_add(&slot->seq, 1);
+  } else if (number != 0) {
+    // no room in the index near this path's hash; give the chunk back
+    Chunk* chunk = GetChunk(number - 1);
+    SizeClass* free_class = &header->classes[size_class];
+    chunk->next_free = free_class->free;
+    free_class->free = number;
+  }
+
+  __sync_synchronize();
+  header->lock = 0;
+}
+
+void ContentCache::AddPage(int size_class, uint32_t page) {
+  SizeClass* c = &header->classes[size_class];
+  uint32_t per_page = CONTENT_CACHE_PAGE_SIZE / c->chunk_size;
+  page_classes[page] = size_class + 1;
+  if (c->pages++ == 0)
+    c->hand = page * CONTENT_CACHE_PAGE_CHUNKS;
+  for (uint32_t i = per_page; i > 0; --i) {
+    uint32_t number = page * CONTENT_CACHE_PAGE_CHUNKS + i - 1;
+    Chunk* chunk = GetChunk(number);
+    chunk->owner = 0;
+    chunk->next_free = c->free;
+    c->free = number + 1;
+  }
+}
+
+bool ContentCache::ReassignPage(int size_class) {
+  // take pages round robin from the other classes, so a class that
+  // missed out while the segment filled up can still cache
+  uint32_t page = 0;
+  bool found = false;
+  for (uint32_t n = 0; n < header->pages_used && !found; ++n) {
+    page = header->page_hand++ % header->pages_used;
+    found = page_classes[page] != size_class + 1;
+  }
+  if (!found)
+    return false;
+
+  SizeClass* victim = &header->classes[page_classes[page] - 1];
+  uint32_t per_page = CONTENT_CACHE_PAGE_SIZE / victim->chunk_size;
+  for (uint32_t i = 0; i < per_page; ++i) {
+    Chunk* chunk = GetChunk(page * CONTENT_CACHE_PAGE_CHUNKS + i);
+    if (chunk->owner != 0)
+      Evict(chunk->owner - 1);
+  }
+  uint32_t* link = &victim->free;
+  while (*link != 0) {
+    Chunk* chunk = GetChunk(*link - 1);
+    if ((*link - 1) / CONTENT_CACHE_PAGE_CHUNKS == page)
+      *link = chunk->next_free;
+    else
+      link = &chunk->next_free;
+  }
+  if (--victim->pages > 0 &&
+      victim->hand / CONTENT_CACHE_PAGE_CHUNKS == page) {
+    uint32_t next = page;
+    do {
+      next = (next + 1) % header->pages_used;
+    } while (page_classes[next] != page_classes[page]);
+    victim->hand = next * CONTENT_CACHE_PAGE_CHUNKS;
+  }
+
+  AddPage(size_class, page);
+  return true;
+}
+
+uint32_t ContentCache::AllocateChunk(int size_class) {
+  SizeClass* c = &header->classes[size_class];
+  uint32_t per_page = CONTENT_CACHE_PAGE_SIZE / c->chunk_size;
+
+  if (c->free == 0 && header->pages_used < header->num_pages)
+    AddPage(size_class, header->pages_used++);
+  else if (c->free == 0 && c->pages == 0 && !ReassignPage(size_class))
+    return 0;
+
+  if (c->free != 0) {
+    uint32_t number = c->free;
+    c->free = GetChunk(number - 1)->next_free;
+    return number;
+  }
+  // CLOCK: sweep the class's chunks, sparing those read since the last
+  // pass, and take the first one that wasn't
+  for (uint32_t n = 0; n < 2 * c->pages * per_page; ++n) {
+    uint32_t number = c->hand;
+    uint32_t page = number / CONTENT_CACHE_PAGE_CHUNKS;
+    uint32_t index = number % CONTENT_CACHE_PAGE_CHUNKS + 1;
+    if (index == per_page) {
+      do {
+        page = (page + 1) % header->pages_used;
+      } while (page_classes[page] != size_class + 1);
+      index = 0;
+    }
+    c->hand = page * CONTENT_CACHE_PAGE_CHUNKS + index;
+
+    Chunk* chunk = GetChunk(number);
+    if (chunk->owner == 0)
+      return number + 1;
+    Slot* slot = &slots[chunk->owner - 1];
+    if (slot->referenced) {
+      slot->referenced = 0;
+      continue;
+    }
+    Evict(chunk->owner - 1);
+    // Evict freed it; take it back off the free list
+    c->free = chunk->next_free;
+    return number + 1;
+  }
+  return 0;
+}
+
+void ContentCache::Evict(uint32_t index) {
+  Slot* slot = &slots[index];
+  Chunk* chunk = GetChunk(slot->chunk);
+  SizeClass* c = &header->classes[page_classes[slot->chunk /
+                                               CONTENT_CACHE_PAGE_CHUNKS] - 1];
+  __sync_fetch_and_add(&slot->seq, 1);
+  __sync_synchronize();
+  slot->state = SLOT_DELETED;
+  chunk->owner = 0;
+  chunk->next_free = c->free;
+  c->free = slot->chunk + 1;
+  __sync_synchronize();
+  __sync_fetch_and_add(&slot->seq, 1);
+}
+
+uint64_t ContentCache::Hits() const {
+  return header->hits;
+}
+
+uint64_t ContentCache::Misses() const {
+  return header->misses;
+}
@@ -0,0 +1,124 @@
+/*
+ * content_cache.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTENT_CACHE_HPP_
+#define CONTENT_CACHE_HPP_
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string>
+
+#define CONTENT_CACHE_CLASSES 13
+
+// File bodies cached in one shared memory segment (a memfd), mapped
+// before the workers are forked so they all share one copy: a file read
+// by one worker is a hit for the others.
+//
+// Bodies live in 1 MiB slab pages, each carved into equal chunks of a
+// power-of-two size class once it is first needed.  An open-addressing
+// index maps file paths to chunks.  Readers take no lock: each index
+// slot has a sequence number, odd while a writer changes the slot or its
+// chunk, and a reader copies the body out and keeps it only if the
+// number didn't move.  Writers serialize on a spinlock they only ever
+// try, so a worker that dies holding it stops caching but never blocks
+// serving.  A full class evicts with CLOCK over its chunks, readers
+// setting the reference bit; a class left without pages takes one from
+// another class.  Entries are checked against the file's
+// inode, size and mtime at most every |revalidate_ms|.
+class ContentCache {
+ public:
+  ContentCache(size_t bytes, long revalidate_ms);
+  ~ContentCache();
+
+  // Largest body Store() accepts.
+  size_t MaxBodySize() const;
+
+  // Copies the body cached for the file at |path| into |body|.
+  bool Lookup(const std::string& path, std::string* body);
+  // Caches |length| bytes of the file at |path|, described by |statbuf|.
+  void Store(const std::string& path, const struct stat& statbuf,
+             const char* data, size_t length);
+
+  uint64_t Hits() const;
+  uint64_t Misses() const;
+
+ private:
+  struct Slot {
+    uint32_t seq;
+    uint8_t state;
+    uint8_t referenced;
+    uint16_t key_length;
+    uint64_t hash;
+    uint64_t chunk;
+    uint64_t length;
+    uint64_t device;
+    uint64_t inode;
+    int64_t mtime_ns;
+    uint64_t validated_ms;
+  };
+
+  struct Chunk {
+    // index of the slot using this chunk plus one, 0 when free
+    uint32_t owner;
+    uint32_t next_free;
+    char data[8];
+  };
+
+  struct SizeClass {
+    uint32_t chunk_size;
+    // chunk number plus one, 0 for none
+    uint32_t free;
+    // CLOCK hand: a chunk number
+    uint32_t hand;
+    uint32_t pages;
+  };
+
+  struct Header {
+    uint32_t lock;
+    uint32_t num_slots;
+    uint32_t num_pages;
+    uint32_t pages_used;
+    uint32_t page_hand;
+    uint64_t hits;
+    uint64_t misses;
+    SizeClass classes[CONTENT_CACHE_CLASSES];
+  };
+
+  int fd;
+  char* base;
+  size_t size;
+  long revalidate_ms;
+  Header* header;
+  Slot* slots;
+  uint8_t* page_classes;
+  char* pages;
+
+  Chunk* GetChunk(uint32_t number) const;
+  void AddPage(int size_class, uint32_t page);
+  bool ReassignPage(int size_class);
+  uint32_t AllocateChunk(int size_class);
+  void Evict(uint32_t slot);
+  Slot* FindSlot(uint64_t hash, const std::string& path) const;
+};
+
+#endif
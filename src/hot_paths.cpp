@@ -0,0 +1,202 @@
+/*
+ * hot_paths.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hot_paths.hpp"
+
+#define HOT_PATHS_PROBES 16
+
+namespace {
+
+uint64_t HashPath(const char* path, size_t length) {
+  // FNV-1a; 0 marks an empty slot
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= (unsigned char)path[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+bool ByHits(const std::pair<std::string, uint32_t>& a,
+            const std::pair<std::string, uint32_t>& b) {
+  return a.second > b.second;
+}
+
+}
+
+HotPaths::HotPaths() {
+  size_t size = sizeof(Slot) * HOT_PATHS_SLOTS;
+  fd = memfd_create("myhttpd-hot-paths", MFD_CLOEXEC);
+  if (fd == -1 || ftruncate(fd, size) == -1) {
+    perror("memfd_create");
+    throw std::exception();
+  }
+  slots = (Slot*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (slots == MAP_FAILED) {
+    perror("mmap");
+    throw std::exception();
+  }
+}
+
+HotPaths::HotPaths(int fd) : fd(fd) {
+  size_t size = sizeof(Slot) * HOT_PATHS_SLOTS;
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) == -1 || (size_t)statbuf.st_size != size) {
+    fprintf(stderr, "Hot path table %d has an unexpected size\n", fd);
+    throw std::exception();
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  slots = (Slot*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (slots == MAP_FAILED) {
+    perror("mmap");
+    throw std::exception();
+  }
+}
+
+HotPaths::~HotPaths() {
+  munmap(slots, sizeof(Slot) * HOT_PATHS_SLOTS);
+  close(fd);
+}
+
+void HotPaths::Record(const char* path, size_t length) {
+  Add(path, length, 1);
+}
+
+void HotPaths::Add(const char* path, size_t length, uint32_t hits) {
+  if (length == 0 || length > HOT_PATHS_MAX_PATH)
+    return;
+
+  uint64_t hash = HashPath(path, length);
+  size_t index = hash % HOT_PATHS_SLOTS;
+  for (int probe = 0; probe < HOT_PATHS_PROBES; ++probe) {
+    Slot* slot = &slots[(index + probe) % HOT_PATHS_SLOTS];
+    uint64_t current = slot->hash;
+    if (current == 0) {
+      current = __sync_val_compare_and_swap(&slot->hash, (uint64_t)0, hash);
+      if (current == 0) {
+        memcpy(slot->path, path, length);
+        __sync_synchronize();
+        slot->length = length;
+        current = hash;
+      }
+    }
+    if (current == hash) {
+      __sync_fetch_and_add(&slot->hits, hits);
+      return;
+    }
+  }
+}
+
+void HotPaths::Import(const HotPaths& other) {
+  for (size_t i = 0; i < HOT_PATHS_SLOTS; ++i) {
+    const Slot& slot = other.slots[i];
+    size_t length = slot.length;
+    __sync_synchronize();
+    if (length != 0 && slot.hits != 0)
+      Add(slot.path, length, slot.hits);
+  }
+}
+
+void HotPaths::Snapshot(
+    size_t limit,
+    std::vector<std::pair<std::string, uint32_t> >* paths) const {
+  paths->clear();
+  for (size_t i = 0; i < HOT_PATHS_SLOTS; ++i) {
+    const Slot& slot = slots[i];
+    size_t length = slot.length;
+    __sync_synchronize();
+    if (length != 0 && slot.hits != 0)
+      paths->push_back(std::make_pair(std::string(slot.path, length),
+                                      slot.hits));
+  }
+  std::sort(paths->begin(), paths->end(), ByHits);
+  if (paths->size() > limit)
+    paths->resize(limit);
+}
+
+bool HotPaths::Save(const std::string& filename, size_t limit) const {
+  std::vector<std::pair<std::string, uint32_t> > paths;
+  Snapshot(limit, &paths);
+
+  // an old and a new server may both be saving during an upgrade
+  std::string temp = filename + ".XXXXXX";
+  int fd = mkostemp(&temp[0], O_CLOEXEC);
+  FILE* file = fd == -1 || fchmod(fd, 0644) == -1 ? NULL : fdopen(fd, "w");
+  if (file == NULL) {
+    perror("hot path manifest");
+    if (fd != -1) {
+      close(fd);
+      unlink(temp.c_str());
+    }
+    return false;
+  }
+  for (size_t i = 0; i < paths.size(); ++i)
+    fprintf(file, "%u %s\n", paths[i].second, paths[i].first.c_str());
+  bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+  if (fclose(file) != 0)
+    ok = false;
+  if (!ok || rename(temp.c_str(), filename.c_str()) == -1) {
+    perror("hot path manifest");
+    unlink(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool HotPaths::Load(const std::string& filename) {
+  FILE* file = fopen(filename.c_str(), "re");
+  if (file == NULL) {
+    if (errno != ENOENT)
+      perror("hot path manifest");
+    return false;
+  }
+  char line[HOT_PATHS_MAX_PATH + 32];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char* path;
+    unsigned long hits = strtoul(line, &path, 10);
+    if (*path != ' ' || hits == 0)
+      continue;
+    ++path;
+    size_t length = strcspn(path, "\r\n");
+    Add(path, length, hits > UINT32_MAX ? UINT32_MAX : hits);
+  }
+  fclose(file);
+  return true;
+}
+
+int HotPaths::GetFd() const {
+  return fd;
+}
@@ -0,0 +1,78 @@
+/*
+ * hot_paths.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOT_PATHS_HPP_
+#define HOT_PATHS_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#define HOT_PATHS_SLOTS 4096
+#define HOT_PATHS_MAX_PATH 240
+
+// Request counts per path in a fixed open-addressing table in shared
+// memory (a memfd), so the worker processes of one server count into the
+// same table and a re-executed server can map the old one's table from
+// an inherited descriptor.  Slots are claimed and counted with atomic
+// operations only; paths that don't fit are not counted.
+class HotPaths {
+ public:
+  HotPaths();
+  // Maps the table behind |fd|, as passed to a re-executed server.
+  explicit HotPaths(int fd);
+  ~HotPaths();
+
+  void Record(const char* path, size_t length);
+
+  // Adds the counts of |other| to this table.
+  void Import(const HotPaths& other);
+
+  // Paths with their counts, most requested first, at most |limit|.
+  void Snapshot(size_t limit,
+                std::vector<std::pair<std::string, uint32_t> >* paths) const;
+
+  // Writes the |limit| most requested paths to |filename|, one "hits path"
+  // line each, replacing the file atomically.
+  bool Save(const std::string& filename, size_t limit) const;
+  // Adds the counts in a file written by Save().
+  bool Load(const std::string& filename);
+
+  int GetFd() const;
+
+ private:
+  struct Slot {
+    uint64_t hash;
+    uint32_t hits;
+    // set once the path is written, with a barrier in between
+    uint16_t length;
+    char path[HOT_PATHS_MAX_PATH];
+  };
+
+  int fd;
+  Slot* slots;
+
+  void Add(const char* path, size_t length, uint32_t hits);
+};
+
+#endif
@@ -0,0 +1,467 @@
+/*
+ * hpack.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "hpack.hpp"
+
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+#define HPACK_ENTRY_OVERHEAD 32
+
+namespace {
+
+struct StaticEntry {
+  const char* name;
+  const char* value;
+};
+
+const StaticEntry static_table[] = {
+  { ":authority", "" },
+  { ":method", "GET" },
+  { ":method", "POST" },
+  { ":path", "/" },
+  { ":path", "/index.html" },
+  { ":scheme", "http" },
+  { ":scheme", "https" },
+  { ":status", "200" },
+  { ":status", "204" },
+  { ":status", "206" },
+  { ":status", "304" },
+  { ":status", "400" },
+  { ":status", "404" },
+  { ":status", "500" },
+  { "accept-charset", "" },
+  { "accept-encoding", "gzip, deflate" },
+  { "accept-language", "" },
+  { "accept-ranges", "" },
+  { "accept", "" },
+  { "access-control-allow-origin", "" },
+  { "age", "" },
+  { "allow", "" },
+  { "authorization", "" },
+  { "cache-control", "" },
+  { "content-disposition", "" },
+  { "content-encoding", "" },
+  { "content-language", "" },
+  { "content-length", "" },
+  { "content-location", "" },
+  { "content-range", "" },
+  { "content-type", "" },
+  { "cookie", "" },
+  { "date", "" },
+  { "etag", "" },
+  { "expect", "" },
+  { "expires", "" },
+  { "from", "" },
+  { "host", "" },
+  { "if-match", "" },
+  { "if-modified-since", "" },
+  { "if-none-match", "" },
+  { "if-range", "" },
+  { "if-unmodified-since", "" },
+  { "last-modified", "" },
+  { "link", "" },
+  { "location", "" },
+  { "max-forwards", "" },
+  { "proxy-authenticate", "" },
+  { "proxy-authorization", "" },
+  { "range", "" },
+  { "referer", "" },
+  { "refresh", "" },
+  { "retry-after", "" },
+  { "server", "" },
+  { "set-cookie", "" },
+  { "strict-transport-security", "" },
+  { "transfer-encoding", "" },
+  { "user-agent", "" },
+  { "vary", "" },
+  { "via", "" },
+  { "www-authenticate", "" },
+};
+
+const size_t static_table_size =
+    sizeof(static_table) / sizeof(static_table[0]);
+
+struct HuffmanCode {
+  uint32_t code;
+  uint8_t length;
+};
+
+const HuffmanCode huffman_codes[] = {
+  { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+  { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+  { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+  { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+  { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+  { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+  { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+  { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+  { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+  { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+  { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+  { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+  { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+  { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+  { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+  { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+  { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+  { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+  { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+  { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+  { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+  { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+  { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+  { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+  { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+  { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+  { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+  { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+  { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+  { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+  { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+  { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+  { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+  { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+  { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+  { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+  { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+  { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+  { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+  { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+  { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+  { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+  { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+  { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+  { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+  { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+  { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+  { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+  { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+  { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+  { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+  { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+  { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+  { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+  { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+  { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+  { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+  { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+  { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+  { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+  { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+  { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+  { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+  { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+};
+
+const uint32_t huffman_eos = 256;
+
+// Binary decoding tree over the Huffman codes; leaves hold the symbol.
+class HuffmanTree {
+ public:
+  HuffmanTree() {
+    nodes.push_back(Node());
+    for (uint32_t sym = 0; sym < 256; ++sym)
+      Insert(huffman_codes[sym].code, huffman_codes[sym].length, sym);
+    Insert(0x3fffffff, 30, huffman_eos);
+  }
+
+  bool Decode(const std::string& in, std::string* out) const {
+    size_t node = 0;
+    int depth = 0;
+    bool all_ones = true;
+    for (size_t i = 0; i < in.length(); ++i) {
+      unsigned char byte = in[i];
+      for (int bit = 7; bit >= 0; --bit) {
+        int b = (byte >> bit) & 1;
+        node = nodes[node].child[b];
+        if (node == 0)
+          return false;
+        ++depth;
+        all_ones = all_ones && b == 1;
+        if (nodes[node].symbol >= 0) {
+          if ((uint32_t)nodes[node].symbol == huffman_eos)
+            return false;
+          out->push_back((char)nodes[node].symbol);
+          node = 0;
+          depth = 0;
+          all_ones = true;
+        }
+      }
+    }
+    // padding is a prefix of EOS, shorter than a byte
+    return depth < 8 && all_ones;
+  }
+
+ private:
+  struct Node {
+    size_t child[2];
+    int symbol;
+
+    Node() : symbol(-1) {
+      child[0] = child[1] = 0;
+    }
+  };
+
+  std::vector<Node> nodes;
+
+  void Insert(uint32_t code, int length, uint32_t symbol) {
+    size_t node = 0;
+    for (int bit = length - 1; bit >= 0; --bit) {
+      int b = (code >> bit) & 1;
+      if (nodes[node].child[b] == 0) {
+        nodes[node].child[b] = nodes.size();
+        nodes.push_back(Node());
+      }
+      node = nodes[node].child[b];
+    }
+    nodes[node].symbol = symbol;
+  }
+};
+
+const HuffmanTree& Huffman() {
+  static HuffmanTree tree;
+  return tree;
+}
+
+bool DecodeInteger(const std::string& in, size_t* pos, int prefix_bits,
+                   uint64_t* value) {
+  if (*pos >= in.length())
+    return false;
+  uint64_t max_prefix = (1 << prefix_bits) - 1;
+  *value = (unsigned char)in[(*pos)++] & max_prefix;
+  if (*value < max_prefix)
+    return true;
+
+  for (int shift = 0; shift < 56; shift += 7) {
+    if (*pos >= in.length())
+      return false;
+    unsigned char byte = in[(*pos)++];
+    *value += (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+void EncodeInteger(uint64_t value, int prefix_bits, unsigned char first,
+                   std::string* out) {
+  uint64_t max_prefix = (1 << prefix_bits) - 1;
+  if (value < max_prefix) {
+    out->push_back((char)(first | value));
+    return;
+  }
+  out->push_back((char)(first | max_prefix));
+  value -= max_prefix;
+  while (value >= 0x80) {
+    out->push_back((char)((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back((char)value);
+}
+
+bool DecodeString(const std::string& in, size_t* pos, std::string* out) {
+  if (*pos >= in.length())
+    return false;
+  bool huffman = (in[*pos] & 0x80) != 0;
+  uint64_t length;
+  if (!DecodeInteger(in, pos, 7, &length) || length > in.length() - *pos)
+    return false;
+
+  out->clear();
+  if (huffman) {
+    if (!Huffman().Decode(in.substr(*pos, length), out))
+      return false;
+  } else {
+    out->assign(in, *pos, length);
+  }
+  *pos += length;
+  return true;
+}
+
+void EncodeString(const std::string& s, std::string* out) {
+  EncodeInteger(s.length(), 7, 0x00, out);
+  out->append(s);
+}
+
+}
+
+HpackTable::HpackTable(size_t max_size) : size(0), max_size(max_size) {
+}
+
+void HpackTable::SetMaxSize(size_t max_size) {
+  this->max_size = max_size;
+  Evict(max_size);
+}
+
+void HpackTable::Evict(size_t limit) {
+  while (size > limit && !entries.empty()) {
+    const std::pair<std::string, std::string>& oldest = entries.back();
+    size -= oldest.first.length() + oldest.second.length() +
+        HPACK_ENTRY_OVERHEAD;
+    entries.pop_back();
+  }
+}
+
+void HpackTable::Add(const std::string& name, const std::string& value) {
+  size_t entry_size = name.length() + value.length() + HPACK_ENTRY_OVERHEAD;
+  if (entry_size > max_size) {
+    // an entry larger than the table empties it
+    Evict(0);
+    return;
+  }
+  Evict(max_size - entry_size);
+  entries.push_front(std::make_pair(name, value));
+  size += entry_size;
+}
+
+bool HpackTable::Get(size_t index, std::string* name,
+                     std::string* value) const {
+  if (index == 0)
+    return false;
+  if (index <= static_table_size) {
+    *name = static_table[index - 1].name;
+    *value = static_table[index - 1].value;
+    return true;
+  }
+  index -= static_table_size + 1;
+  if (index >= entries.size())
+    return false;
+  *name = entries[index].first;
+  *value = entries[index].second;
+  return true;
+}
+
+size_t HpackTable::Find(const std::string& name, const std::string& value,
+                        bool* exact) const {
+  size_t name_index = 0;
+  for (size_t i = 0; i < static_table_size; ++i) {
+    if (name != static_table[i].name)
+      continue;
+    if (value == static_table[i].value) {
+      *exact = true;
+      return i + 1;
+    }
+    if (name_index == 0)
+      name_index = i + 1;
+  }
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].first != name)
+      continue;
+    if (entries[i].second == value) {
+      *exact = true;
+      return static_table_size + 1 + i;
+    }
+    if (name_index == 0)
+      name_index = static_table_size + 1 + i;
+  }
+  *exact = false;
+  return name_index;
+}
+
+HpackDecoder::HpackDecoder() : table(HPACK_DEFAULT_TABLE_SIZE) {
+}
+
+bool HpackDecoder::Decode(const std::string& block, HeaderList* headers) {
+  size_t pos = 0;
+  while (pos < block.length()) {
+    unsigned char first = block[pos];
+    uint64_t index;
+    std::string name, value;
+
+    if (first & 0x80) {
+      // indexed header field
+      if (!DecodeInteger(block, &pos, 7, &index) ||
+          !table.Get(index, &name, &value))
+        return false;
+      headers->push_back(std::make_pair(name, value));
+      continue;
+    }
+
+    if ((first & 0xe0) == 0x20) {
+      // dynamic table size update, bounded by our advertised default
+      if (!DecodeInteger(block, &pos, 5, &index) ||
+          index > HPACK_DEFAULT_TABLE_SIZE)
+        return false;
+      table.SetMaxSize(index);
+      continue;
+    }
+
+    // literal: with incremental indexing (01), without (0000) or never
+    // indexed (0001)
+    bool indexing = (first & 0xc0) == 0x40;
+    if (!DecodeInteger(block, &pos, indexing ? 6 : 4, &index))
+      return false;
+    if (index == 0) {
+      if (!DecodeString(block, &pos, &name))
+        return false;
+    } else if (!table.Get(index, &name, &value)) {
+      return false;
+    }
+    if (!DecodeString(block, &pos, &value))
+      return false;
+
+    if (indexing)
+      table.Add(name, value);
+    headers->push_back(std::make_pair(name, value));
+  }
+  return true;
+}
+
+HpackEncoder::HpackEncoder()
+    : table(HPACK_DEFAULT_TABLE_SIZE), size_update(false),
+      max_size(HPACK_DEFAULT_TABLE_SIZE) {
+}
+
+void HpackEncoder::SetMaxTableSize(size_t max_size) {
+  max_size = std::min(max_size, (size_t)HPACK_DEFAULT_TABLE_SIZE);
+  if (max_size == this->max_size)
+    return;
+  this->max_size = max_size;
+  table.SetMaxSize(max_size);
+  size_update = true;
+}
+
+void HpackEncoder::Encode(const HeaderList& headers, std::string* block) {
+  if (size_update) {
+    EncodeInteger(max_size, 5, 0x20, block);
+    size_update = false;
+  }
+
+  for (size_t i = 0; i < headers.size(); ++i) {
+    const std::string& name = headers[i].first;
+    const std::string& value = headers[i].second;
+    bool exact;
+    size_t index = table.Find(name, value, &exact);
+    if (exact) {
+      EncodeInteger(index, 7, 0x80, block);
+      continue;
+    }
+
+    EncodeInteger(index, 6, 0x40, block);
+    if (index == 0)
+      EncodeString(name, block);
+    EncodeString(value, block);
+    table.Add(name, value);
+  }
+}
@@ -0,0 +1,84 @@
+/*
+ * hpack.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HPACK_HPP_
+#define HPACK_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// HPACK header compression for HTTP/2 (RFC 7541).
+
+typedef std::vector<std::pair<std::string, std::string> > HeaderList;
+
+// The dynamic table, addressed together with the static table: indexes
+// 1-61 are static entries and 62 onwards the newest dynamic entries.
+class HpackTable {
+ public:
+  explicit HpackTable(size_t max_size);
+
+  void SetMaxSize(size_t max_size);
+  void Add(const std::string& name, const std::string& value);
+  bool Get(size_t index, std::string* name, std::string* value) const;
+  // Index of an entry matching name and value, else of one matching the
+  // name only (|exact| false), else 0.
+  size_t Find(const std::string& name, const std::string& value,
+              bool* exact) const;
+
+ private:
+  std::deque<std::pair<std::string, std::string> > entries;
+  size_t size;
+  size_t max_size;
+
+  void Evict(size_t limit);
+};
+
+class HpackDecoder {
+ public:
+  HpackDecoder();
+
+  // Decodes a complete header block; false on a compression error.
+  bool Decode(const std::string& block, HeaderList* headers);
+
+ private:
+  HpackTable table;
+};
+
+class HpackEncoder {
+ public:
+  HpackEncoder();
+
+  // Applies the peer's SETTINGS_HEADER_TABLE_SIZE.
+  void SetMaxTableSize(size_t max_size);
+  void Encode(const HeaderList& headers, std::string* block);
+
+ private:
+  HpackTable table;
+  bool size_update;
+  size_t max_size;
+};
+
+#endif
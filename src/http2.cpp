@@ -0,0 +1,703 @@
+/*
+ * http2.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "bandwidth.hpp"
+#include "hpack.hpp"
+#include "http2.hpp"
+#include "http_request.hpp"
+#include "probes.hpp"
+
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_INTERNAL_ERROR 0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_COMPRESSION_ERROR 0x9
+#define H2_ENHANCE_YOUR_CALM 0xb
+
+#define H2_SETTINGS_HEADER_TABLE_SIZE 0x1
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+
+#define H2_FRAME_HEADER_SIZE 9
+#define H2_DEFAULT_FRAME_SIZE 16384
+#define H2_DEFAULT_WINDOW 65535
+#define H2_MAX_WINDOW 0x7fffffff
+#define H2_MAX_STREAMS 256
+// a HEADERS frame and its CONTINUATIONs together
+#define H2_MAX_HEADER_BLOCK 65536
+// stop queueing DATA once this much output is waiting for the socket
+#define H2_OUTPUT_HIGH_WATER 65536
+
+namespace {
+
+const char client_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+uint32_t Read32(const std::string& s, size_t pos) {
+  return ((uint32_t)(unsigned char)s[pos] << 24) |
+      ((uint32_t)(unsigned char)s[pos + 1] << 16) |
+      ((uint32_t)(unsigned char)s[pos + 2] << 8) |
+      (uint32_t)(unsigned char)s[pos + 3];
+}
+
+void Append32(uint32_t value, std::string* s) {
+  s->push_back((char)(value >> 24));
+  s->push_back((char)(value >> 16));
+  s->push_back((char)(value >> 8));
+  s->push_back((char)value);
+}
+
+void AppendSetting(uint16_t id, uint32_t value, std::string* s) {
+  s->push_back((char)(id >> 8));
+  s->push_back((char)id);
+  Append32(value, s);
+}
+
+bool DecodeBase64Url(const std::string& in, std::string* out) {
+  uint32_t buffer = 0;
+  int bits = 0;
+  for (size_t i = 0; i < in.length(); ++i) {
+    char c = in[i];
+    int value;
+    if (c >= 'A' && c <= 'Z')
+      value = c - 'A';
+    else if (c >= 'a' && c <= 'z')
+      value = c - 'a' + 26;
+    else if (c >= '0' && c <= '9')
+      value = c - '0' + 52;
+    else if (c == '-' || c == '+')
+      value = 62;
+    else if (c == '_' || c == '/')
+      value = 63;
+    else if (c == '=')
+      break;
+    else
+      return false;
+
+    buffer = (buffer << 6) | value;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out->push_back((char)(buffer >> bits));
+    }
+  }
+  return true;
+}
+
+}
+
+Http2Connection::Http2Connection(int fd, const std::string& http_root,
+                                 int timeout, BandwidthLimiter* bandwidth,
+                                 int drain_fd)
+    : fd(fd), http_root(http_root), timeout(timeout), drain_fd(drain_fd),
+      pacer(bandwidth),
+      pace_wait_us(0), last_scheduled(0),
+      last_stream_id(0), send_window(H2_DEFAULT_WINDOW),
+      initial_window(H2_DEFAULT_WINDOW), max_frame_size(H2_DEFAULT_FRAME_SIZE),
+      continuation_stream(0), continuation_end_stream(false),
+      going_away(false) {
+}
+
+Http2Connection::~Http2Connection() {
+  while (!streams.empty())
+    CloseStream(streams.begin()->first);
+}
+
+bool Http2Connection::IsUpgrade(const HttpRequest& req) {
+  // RFC 7540 3.2: exactly one HTTP2-Settings, or it isn't an h2c upgrade
+  int settings = 0;
+  for (size_t i = 0; i < req.headers.size(); ++i) {
+    if (EqualsIgnoreCase(req.headers[i].first, "HTTP2-Settings"))
+      ++settings;
+  }
+  return settings == 1 && req.http_mode == "HTTP/1.1" &&
+      EqualsIgnoreCase(req.GetHeader("Upgrade"), "h2c") &&
+      (req.method == "GET" || req.method == "HEAD") &&
+      (req.GetHeader("Content-Length").empty() ||
+       req.GetHeader("Content-Length") == "0") &&
+      req.GetHeader("Transfer-Encoding").empty();
+}
+
+void Http2Connection::ServePriorKnowledge(std::string* pending) {
+  // the request line and blank line were consumed as an HTTP/1 request
+  preface = client_preface + strlen("PRI * HTTP/2.0\r\n\r\n");
+  in.swap(*pending);
+  Run(NULL);
+}
+
+void Http2Connection::ServeUpgrade(const HttpRequest& req,
+                                   std::string* pending) {
+  Write(fd, "HTTP/1.1 101 Switching Protocols\r\n"
+        "Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+
+  std::string settings;
+  preface = client_preface;
+  in.swap(*pending);
+  if (!DecodeBase64Url(req.GetHeader("HTTP2-Settings"), &settings) ||
+      settings.length() % 6 != 0 || !ApplySettings(settings)) {
+    // the connection is HTTP/2 since the 101; end it the HTTP/2 way
+    WriteFrame(H2_SETTINGS, 0, 0, "");
+    GoAway(H2_PROTOCOL_ERROR);
+    Write(fd, out);
+    out.clear();
+    return;
+  }
+
+  last_stream_id = 1;
+  Run(&req);
+}
+
+void Http2Connection::Run(const HttpRequest* upgraded) {
+  int flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+  std::string settings;
+  AppendSetting(H2_SETTINGS_MAX_CONCURRENT_STREAMS, H2_MAX_STREAMS, &settings);
+  WriteFrame(H2_SETTINGS, 0, 0, settings);
+  if (upgraded != NULL)
+    Respond(1, upgraded->method, upgraded->uri);
+
+  while (!going_away || !streams.empty() || !out.empty()) {
+    Schedule();
+
+    // a stream held back by the rate caps is due again after pace_wait_us
+    int wait_ms = timeout * 1000;
+    if (pace_wait_us > 0)
+      wait_ms = std::min((long)wait_ms, pace_wait_us / 1000 + 1);
+
+    // the drain stays readable, so it is only watched until the GOAWAY
+    pollfd p[2];
+    p[0].fd = fd;
+    p[0].events = POLLIN | (out.empty() ? 0 : POLLOUT);
+    p[0].revents = 0;
+    p[1].fd = going_away ? -1 : drain_fd;
+    p[1].events = POLLIN;
+    p[1].revents = 0;
+    int rv = poll(p, 2, wait_ms);
+    if (rv == -1) {
+      if (errno == EINTR)
+        continue;
+      throw errno;
+    }
+    if (rv == 0 && pace_wait_us > 0)
+      continue;
+    if (rv == 0) {
+      // idle past the keep-alive timeout
+      GoAway(H2_NO_ERROR);
+      break;
+    }
+    if (p[1].revents != 0)
+      GoAway(H2_NO_ERROR);
+
+    if (p[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      char buf[16384];
+      while (true) {
+        ssize_t numread = read(fd, buf, sizeof(buf));
+        if (numread == 0)
+          return;
+        if (numread == -1) {
+          if (errno == EAGAIN || errno == EINTR)
+            break;
+          throw errno;
+        }
+        in.append(buf, numread);
+      }
+      if (!ProcessInput()) {
+        while (!streams.empty())
+          CloseStream(streams.begin()->first);
+      }
+    }
+
+    Flush();
+  }
+
+  // hand whatever is left (a GOAWAY at least) to the kernel
+  fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+  Write(fd, out);
+  out.clear();
+}
+
+bool Http2Connection::ProcessInput() {
+  if (!preface.empty()) {
+    size_t n = std::min(preface.length(), in.length());
+    if (in.compare(0, n, preface, 0, n) != 0) {
+      GoAway(H2_PROTOCOL_ERROR);
+      return false;
+    }
+    in.erase(0, n);
+    preface.erase(0, n);
+    if (!preface.empty())
+      return true;
+  }
+
+  size_t pos = 0;
+  bool ok = true;
+  while (ok && in.length() - pos >= H2_FRAME_HEADER_SIZE) {
+    uint32_t length = Read32(in, pos) >> 8;
+    if (length > H2_DEFAULT_FRAME_SIZE) {
+      GoAway(H2_FRAME_SIZE_ERROR);
+      return false;
+    }
+    if (in.length() - pos < H2_FRAME_HEADER_SIZE + length)
+      break;
+
+    uint8_t type = in[pos + 3];
+    uint8_t flags = in[pos + 4];
+    uint32_t id = Read32(in, pos + 5) & 0x7fffffff;
+    std::string payload = in.substr(pos + H2_FRAME_HEADER_SIZE, length);
+    pos += H2_FRAME_HEADER_SIZE + length;
+    ok = HandleFrame(type, flags, id, payload);
+  }
+  in.erase(0, pos);
+  return ok;
+}
+
+bool Http2Connection::HandleFrame(uint8_t type, uint8_t flags, uint32_t id,
+                                  const std::string& payload) {
+  if (continuation_stream != 0 &&
+      (type != H2_CONTINUATION || id != continuation_stream)) {
+    GoAway(H2_PROTOCOL_ERROR);
+    return false;
+  }
+
+  switch (type) {
+    case H2_DATA:
+      // request bodies are not used; hand the credit straight back
+      if (id == 0) {
+        GoAway(H2_PROTOCOL_ERROR);
+        return false;
+      }
+      if (!payload.empty())
+        WriteWindowUpdate(0, payload.length());
+      return true;
+
+    case H2_HEADERS: {
+      if (id == 0 || id % 2 == 0 || id <= last_stream_id) {
+        GoAway(H2_PROTOCOL_ERROR);
+        return false;
+      }
+      size_t begin = 0;
+      size_t padding = 0;
+      if (flags & H2_FLAG_PADDED) {
+        if (payload.empty()) {
+          GoAway(H2_PROTOCOL_ERROR);
+          return false;
+        }
+        padding = (unsigned char)payload[0];
+        begin = 1;
+      }
+      if (flags & H2_FLAG_PRIORITY)
+        begin += 5;
+      if (begin + padding > payload.length()) {
+        GoAway(H2_PROTOCOL_ERROR);
+        return false;
+      }
+
+      last_stream_id = id;
+      header_block.assign(payload, begin, payload.length() - begin - padding);
+      continuation_end_stream = (flags & H2_FLAG_END_STREAM) != 0;
+      if (flags & H2_FLAG_END_HEADERS)
+        return HandleHeaders(id, continuation_end_stream);
+      continuation_stream = id;
+      return true;
+    }
+
+    case H2_CONTINUATION:
+      if (continuation_stream == 0) {
+        GoAway(H2_PROTOCOL_ERROR);
+        return false;
+      }
+      if (header_block.length() + payload.length() > H2_MAX_HEADER_BLOCK) {
+        GoAway(H2_ENHANCE_YOUR_CALM);
+        return false;
+      }
+      header_block += payload;
+      if (flags & H2_FLAG_END_HEADERS) {
+        continuation_stream = 0;
+        return HandleHeaders(id, continuation_end_stream);
+      }
+      return true;
+
+    case H2_PRIORITY:
+      return true;
+
+    case H2_RST_STREAM:
+      if (id == 0 || payload.length() != 4) {
+        GoAway(H2_PROTOCOL_ERROR);
+        return false;
+      }
+      CloseStream(id);
+      return true;
+
+    case H2_SETTINGS:
+      if (id != 0) {
+        GoAway(H2_PROTOCOL_ERROR);
+        return false;
+      }
+      if (flags & H2_FLAG_ACK)
+        return true;
+      if (payload.length() % 6 != 0) {
+        GoAway(H2_FRAME_SIZE_ERROR);
+        return false;
+      }
+      if (!ApplySettings(payload)) {
+        GoAway(H2_PROTOCOL_ERROR);
+        return false;
+      }
+      WriteFrame(H2_SETTINGS, H2_FLAG_ACK, 0, "");
+      return true;
+
+    case H2_PING:
+      if (id != 0 || payload.length() != 8) {
+        GoAway(H2_PROTOCOL_ERROR);
+        return false;
+      }
+      if (!(flags & H2_FLAG_ACK))
+        WriteFrame(H2_PING, H2_FLAG_ACK, 0, payload);
+      return true;
+
+    case H2_GOAWAY:
+      // finish the streams we have and stop
+      going_away = true;
+      return true;
+
+    case H2_WINDOW_UPDATE: {
+      if (payload.length() != 4) {
+        GoAway(H2_FRAME_SIZE_ERROR);
+        return false;
+      }
+      uint32_t increment = Read32(payload, 0) & 0x7fffffff;
+      if (id == 0) {
+        if (increment == 0 || send_window + increment > H2_MAX_WINDOW) {
+          GoAway(increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+          return false;
+        }
+        send_window += increment;
+        return true;
+      }
+
+      std::map<uint32_t, Stream*>::iterator it = streams.find(id);
+      if (it == streams.end())
+        return true;
+      Stream* stream = it->second;
+      if (increment == 0 || stream->window + increment > H2_MAX_WINDOW) {
+        ResetStream(id, increment == 0 ? H2_PROTOCOL_ERROR :
+                    H2_FLOW_CONTROL_ERROR);
+        CloseStream(id);
+        return true;
+      }
+      stream->window += increment;
+      return true;
+    }
+
+    case H2_PUSH_PROMISE:
+      GoAway(H2_PROTOCOL_ERROR);
+      return false;
+
+    default:
+      // unknown frame types are ignored
+      return true;
+  }
+}
+
+bool Http2Connection::HandleHeaders(uint32_t id, bool end_stream) {
+  HeaderList headers;
+  bool decoded = decoder.Decode(header_block, &headers);
+  header_block.clear();
+  if (!decoded) {
+    GoAway(H2_COMPRESSION_ERROR);
+    return false;
+  }
+
+  if (going_away || streams.size() >= H2_MAX_STREAMS) {
+    ResetStream(id, H2_REFUSED_STREAM);
+    return true;
+  }
+
+  std::string method, path;
+  for (size_t i = 0; i < headers.size(); ++i) {
+    if (headers[i].first == ":method")
+      method = headers[i].second;
+    else if (headers[i].first == ":path")
+      path = headers[i].second;
+  }
+  if (method.empty() || path.empty()) {
+    ResetStream(id, H2_PROTOCOL_ERROR);
+    return true;
+  }
+
+  HTTPD_PROBE3(request__parsed, fd, method.c_str(), path.c_str());
+  Respond(id, method, path);
+
+  // the response is complete or under way; we don't read request bodies
+  if (!end_stream && streams.find(id) == streams.end())
+    ResetStream(id, H2_NO_ERROR);
+  return true;
+}
+
+bool Http2Connection::ApplySettings(const std::string& payload) {
+  for (size_t pos = 0; pos + 6 <= payload.length(); pos += 6) {
+    uint16_t id = ((unsigned char)payload[pos] << 8) |
+        (unsigned char)payload[pos + 1];
+    uint32_t value = Read32(payload, pos + 2);
+    switch (id) {
+      case H2_SETTINGS_HEADER_TABLE_SIZE:
+        encoder.SetMaxTableSize(value);
+        break;
+      case H2_SETTINGS_ENABLE_PUSH:
+        if (value > 1)
+          return false;
+        break;
+      case H2_SETTINGS_INITIAL_WINDOW_SIZE: {
+        if (value > H2_MAX_WINDOW)
+          return false;
+        int64_t delta = (int64_t)value - initial_window;
+        for (std::map<uint32_t, Stream*>::iterator it = streams.begin();
+             it != streams.end(); ++it)
+          it->second->window += delta;
+        initial_window = value;
+        break;
+      }
+      case H2_SETTINGS_MAX_FRAME_SIZE:
+        if (value < H2_DEFAULT_FRAME_SIZE || value > 0xffffff)
+          return false;
+        max_frame_size = value;
+        break;
+      default:
+        break;
+    }
+  }
+  return true;
+}
+
+void Http2Connection::Respond(uint32_t id, const std::string& method,
+                              const std::string& path) {
+  int status = 501;
+  int file = -1;
+  off_t size = 0;
+  if (method == "GET" || method == "HEAD") {
+    status = OpenFile(http_root, path, &file, &size);
+    if (status == 200)
+      HTTPD_PROBE3(file__resolved, fd, path.c_str(), 0);
+  }
+
+  char status_str[16];
+  char length_str[32];
+  snprintf(status_str, sizeof(status_str), "%d", status);
+  snprintf(length_str, sizeof(length_str), "%lld",
+           status == 200 ? (long long)size : 0LL);
+  HeaderList headers;
+  headers.push_back(std::make_pair(std::string(":status"),
+                                   std::string(status_str)));
+  headers.push_back(std::make_pair(std::string("content-length"),
+                                   std::string(length_str)));
+  std::string block;
+  encoder.Encode(headers, &block);
+
+  bool body = status == 200 && method == "GET" && size > 0;
+  if (file != -1 && !body)
+    close(file);
+  WriteFrame(H2_HEADERS,
+             H2_FLAG_END_HEADERS | (body ? 0 : H2_FLAG_END_STREAM), id, block);
+  HTTPD_PROBE1(headers__sent, fd);
+  if (!body)
+    return;
+
+  Stream* stream = new Stream;
+  stream->id = id;
+  stream->file = file;
+  stream->offset = 0;
+  stream->remaining = size;
+  stream->window = initial_window;
+  stream->deficit = 0;
+  streams[id] = stream;
+}
+
+void Http2Connection::Schedule() {
+  pace_wait_us = 0;
+  // hold DATA until the client preface arrives; after an upgrade some
+  // clients can't buffer much past the 101 response
+  if (!preface.empty())
+    return;
+
+  // deficit round robin: each stream that can send gets a quantum per
+  // turn, resuming after the last one served.  What a stream cut short
+  // by the output buffer or the rate caps had left carries over.
+  int64_t quantum = pacer.Quantum();
+  bool progress = true;
+  while (progress && out.length() < H2_OUTPUT_HIGH_WATER && send_window > 0) {
+    progress = false;
+
+    std::map<uint32_t, Stream*>::iterator it =
+        streams.upper_bound(last_scheduled);
+    for (size_t n = streams.size();
+         n > 0 && out.length() < H2_OUTPUT_HIGH_WATER && send_window > 0;
+         --n) {
+      if (it == streams.end())
+        it = streams.begin();
+      Stream* stream = it->second;
+      ++it;
+      last_scheduled = stream->id;
+      if (stream->window <= 0) {
+        stream->deficit = 0;
+        continue;
+      }
+      stream->deficit = std::min(stream->deficit + quantum, 2 * quantum);
+
+      while (stream->deficit > 0 && stream->window > 0 &&
+             out.length() < H2_OUTPUT_HIGH_WATER && send_window > 0) {
+        size_t length = std::min((int64_t)max_frame_size,
+                                 std::min((int64_t)stream->remaining,
+                                          std::min(stream->window,
+                                                   std::min(send_window,
+                                                            stream->deficit))));
+        length = pacer.Grant(length, stream->offset == 0, &pace_wait_us);
+        if (length == 0)
+          return;
+        progress = true;
+        stream->deficit -= length;
+        if (!WriteData(stream, length))
+          break;
+      }
+    }
+  }
+}
+
+bool Http2Connection::WriteData(Stream* stream, size_t length) {
+  size_t header = out.length();
+  out.resize(header + H2_FRAME_HEADER_SIZE + length);
+  ssize_t numread = pread(stream->file, &out[header + H2_FRAME_HEADER_SIZE],
+                          length, stream->offset);
+  if (numread != (ssize_t)length) {
+    out.resize(header);
+    ResetStream(stream->id, H2_INTERNAL_ERROR);
+    CloseStream(stream->id);
+    return false;
+  }
+
+  stream->offset += length;
+  stream->remaining -= length;
+  stream->window -= length;
+  send_window -= length;
+  bool done = stream->remaining == 0;
+
+  out[header] = (char)(length >> 16);
+  out[header + 1] = (char)(length >> 8);
+  out[header + 2] = (char)length;
+  out[header + 3] = H2_DATA;
+  out[header + 4] = done ? H2_FLAG_END_STREAM : 0;
+  std::string id;
+  Append32(stream->id, &id);
+  out.replace(header + 5, 4, id);
+
+  if (done) {
+    HTTPD_PROBE2(body__complete, fd, (long)stream->offset);
+    CloseStream(stream->id);
+    return false;
+  }
+  return true;
+}
+
+void Http2Connection::Flush() {
+  size_t written = 0;
+  while (written < out.length()) {
+    ssize_t cnt = write(fd, out.data() + written, out.length() - written);
+    if (cnt == -1) {
+      if (errno == EAGAIN || errno == EINTR)
+        break;
+      out.clear();
+      throw errno;
+    }
+    written += cnt;
+  }
+  out.erase(0, written);
+}
+
+void Http2Connection::CloseStream(uint32_t id) {
+  std::map<uint32_t, Stream*>::iterator it = streams.find(id);
+  if (it == streams.end())
+    return;
+  close(it->second->file);
+  delete it->second;
+  streams.erase(it);
+}
+
+void Http2Connection::WriteFrame(uint8_t type, uint8_t flags, uint32_t id,
+                                 const std::string& payload) {
+  Append32(payload.length() << 8 | type, &out);
+  out.push_back((char)flags);
+  Append32(id, &out);
+  out += payload;
+}
+
+void Http2Connection::WriteWindowUpdate(uint32_t id, uint32_t increment) {
+  std::string payload;
+  Append32(increment, &payload);
+  WriteFrame(H2_WINDOW_UPDATE, 0, id, payload);
+}
+
+void Http2Connection::ResetStream(uint32_t id, uint32_t error) {
+  std::string payload;
+  Append32(error, &payload);
+  WriteFrame(H2_RST_STREAM, 0, id, payload);
+}
+
+void Http2Connection::GoAway(uint32_t error) {
+  std::string payload;
+  Append32(last_stream_id, &payload);
+  Append32(error, &payload);
+  WriteFrame(H2_GOAWAY, 0, 0, payload);
+  going_away = true;
+}
@@ -0,0 +1,109 @@
+/*
+ * http2.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2_HPP_
+#define HTTP2_HPP_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+
+#include "bandwidth.hpp"
+#include "hpack.hpp"
+
+struct HttpRequest;
+
+// One cleartext HTTP/2 (h2c) connection serving files from http_root.
+// Requests are multiplexed as streams and the bodies of all open streams
+// are interleaved by deficit round robin, a send quantum per stream in
+// turn, within the peer's flow-control windows and |bandwidth|'s rate
+// caps.  Once |drain_fd| becomes readable the connection sends GOAWAY
+// and ends when its open streams are done.
+class Http2Connection {
+ public:
+  Http2Connection(int fd, const std::string& http_root, int timeout,
+                  BandwidthLimiter* bandwidth, int drain_fd = -1);
+  ~Http2Connection();
+
+  // Continues after the "PRI * HTTP/2.0" request line of the connection
+  // preface; |pending| holds whatever was read past it.
+  void ServePriorKnowledge(std::string* pending);
+
+  // Answers an HTTP/1.1 request carrying "Upgrade: h2c" with 101 and
+  // serves it as stream 1 before continuing in HTTP/2.
+  void ServeUpgrade(const HttpRequest& req, std::string* pending);
+
+  static bool IsUpgrade(const HttpRequest& req);
+
+ private:
+  struct Stream {
+    uint32_t id;
+    int file;
+    off_t offset;
+    off_t remaining;
+    int64_t window;
+    int64_t deficit;
+  };
+
+  int fd;
+  std::string http_root;
+  int timeout;
+  int drain_fd;
+  SendPacer pacer;
+  long pace_wait_us;
+  std::string in;
+  std::string out;
+  std::string preface;
+  HpackDecoder decoder;
+  HpackEncoder encoder;
+  std::map<uint32_t, Stream*> streams;
+  uint32_t last_scheduled;
+  uint32_t last_stream_id;
+  int64_t send_window;
+  int64_t initial_window;
+  uint32_t max_frame_size;
+  uint32_t continuation_stream;
+  bool continuation_end_stream;
+  std::string header_block;
+  bool going_away;
+
+  void Run(const HttpRequest* upgraded);
+  bool ProcessInput();
+  bool HandleFrame(uint8_t type, uint8_t flags, uint32_t id,
+                   const std::string& payload);
+  bool HandleHeaders(uint32_t id, bool end_stream);
+  bool ApplySettings(const std::string& payload);
+  void Respond(uint32_t id, const std::string& method,
+               const std::string& path);
+  void Schedule();
+  bool WriteData(Stream* stream, size_t length);
+  void Flush();
+  void CloseStream(uint32_t id);
+  void WriteFrame(uint8_t type, uint8_t flags, uint32_t id,
+                  const std::string& payload);
+  void WriteWindowUpdate(uint32_t id, uint32_t increment);
+  void ResetStream(uint32_t id, uint32_t error);
+  void GoAway(uint32_t error);
+};
+
+#endif
@@ -20,11 +20,14 @@
  */
 
 #include <cerrno>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -33,6 +36,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <deque>
 #include <numeric>
 #include <string>
 #include <vector>
@@ -41,6 +45,7 @@
 #include "http_client.hpp"
 
 #define DOWNLOAD_DIR "Downloads"
+#define FASTOPEN_ENV "HTTP_CLIENT_FASTOPEN"
 
 namespace {
 
@@ -49,6 +54,13 @@ std::vector<long> connect_times;
 
 pthread_mutex_t throughputs_mutex;
 std::vector<long long> throughputs;
+std::vector<long> ttfb_times;
+std::vector<long> transfer_times;
+
+long ElapsedMicros(const timeval& from, const timeval& to) {
+  return (long)((to.tv_sec - from.tv_sec) * 1000000L +
+                to.tv_usec - from.tv_usec);
+}
 
 ssize_t Write(int fd, const std::string& s, size_t* numwritten) {
   ssize_t ret = 0;
@@ -61,7 +73,7 @@ ssize_t Write(int fd, const std::string& s, size_t* numwritten) {
     ret += cnt;
   }
   if (numwritten != NULL)
-    *numwritten = ret;
+    *numwritten += ret;
   return ret;
 }
 
@@ -90,7 +102,7 @@ HttpClient::HttpClient(int argc, char* argv[]) {
   if (argc < 6) {
     fprintf(stderr,
             "Usage: %s <http_mode> <hostname> <port> <URI> <numrequests>"
-            " [<numthreads>]",
+            " [<numthreads> [<numconnections> [<pipeline_depth>]]]",
             argv[0]);
     throw std::exception();
   }
@@ -112,10 +124,33 @@ HttpClient::HttpClient(int argc, char* argv[]) {
     sscanf(argv[6], "%d", &numthreads);
   else
     numthreads = 1;
+  if (argc > 7)
+    sscanf(argv[7], "%d", &numconnections);
+  else
+    numconnections = 1;
+  if (argc > 8)
+    sscanf(argv[8], "%d", &pipeline_depth);
+  else
+    pipeline_depth = 1;
+
+  if (numthreads < 1 || numconnections < 1 || pipeline_depth < 1) {
+    fprintf(stderr, "numthreads, numconnections and pipeline_depth must be"
+            " positive\n");
+    throw std::exception();
+  }
+  if (http_mode == "HTTP/1.0" && pipeline_depth > 1) {
+    fprintf(stderr, "Pipelining requires HTTP/1.1, using depth 1\n");
+    pipeline_depth = 1;
+  }
+
+  address_len = 0;
+  // set to send each request on the SYN once the server's cookie is known
+  const char* fastopen_env = getenv(FASTOPEN_ENV);
+  fastopen = fastopen_env != NULL && atoi(fastopen_env) != 0;
 }
 
-int HttpClient::Connect() {
-  struct addrinfo hints, *servinfo, *p;
+void HttpClient::Resolve() {
+  struct addrinfo hints, *servinfo;
   memset(&hints, 0, sizeof hints);
   hints.ai_family = AF_INET;
   hints.ai_socktype = SOCK_STREAM;
@@ -123,46 +158,43 @@ int HttpClient::Connect() {
   char port_str[10];
   sprintf(port_str, "%d", this->port);
 
-  pthread_mutex_lock(&connect_times_mutex);
   int rv = getaddrinfo(hostname.c_str(), port_str, &hints, &servinfo);
-  pthread_mutex_unlock(&connect_times_mutex);
   if (rv != 0) {
     fprintf(stderr, "getaddrinfo: %s (%d)\n", gai_strerror(rv), rv);
     throw std::exception();
   }
 
-  int sockfd;
-
+  memcpy(&address, servinfo->ai_addr, servinfo->ai_addrlen);
+  address_len = servinfo->ai_addrlen;
+  freeaddrinfo(servinfo);
+}
 
-  for(p = servinfo; p != NULL; p = p->ai_next) {
-    if ((sockfd = socket(p->ai_family, p->ai_socktype,
-                         p->ai_protocol)) == -1) {
-      perror("client: socket");
-      continue;
-    }
+int HttpClient::Connect() {
+  if (address_len == 0)
+    Resolve();
 
-    timeval connect_start, connect_end;
-    gettimeofday(&connect_start, NULL);
-    if (connect(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
-      close(sockfd);
-      perror("client: connect");
-      continue;
-    }
-    gettimeofday(&connect_end, NULL);
-    long connect_time =  (long)(
-        (connect_end.tv_sec - connect_start.tv_sec) * 1000000L +
-        connect_end.tv_usec - connect_start.tv_usec);
-    pthread_mutex_lock(&connect_times_mutex);
-    connect_times.push_back(connect_time);
-    pthread_mutex_unlock(&connect_times_mutex);
-    break;
+  int sockfd = socket(address.ss_family, SOCK_STREAM, 0);
+  if (sockfd == -1) {
+    perror("client: socket");
+    throw std::exception();
   }
-  freeaddrinfo(servinfo);
-
-  if (p == NULL) {
-    fprintf(stderr, "client: failed to connect\n");
+  int on = 1;
+  if (fastopen && setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on,
+                             sizeof(on)) == -1)
+    perror("client: setsockopt TCP_FASTOPEN_CONNECT");
+
+  timeval connect_start, connect_end;
+  gettimeofday(&connect_start, NULL);
+  if (connect(sockfd, (struct sockaddr*)&address, address_len) == -1) {
+    close(sockfd);
+    perror("client: connect");
     throw std::exception();
   }
+  gettimeofday(&connect_end, NULL);
+
+  pthread_mutex_lock(&connect_times_mutex);
+  connect_times.push_back(ElapsedMicros(connect_start, connect_end));
+  pthread_mutex_unlock(&connect_times_mutex);
 
   return sockfd;
 }
@@ -171,80 +203,97 @@ void HttpClient::Request(int fd, const std::string& uri,
                          const std::string& http_mode,
                          const std::string& hostname,
                          size_t* numwritten) {
-  Write(fd, "GET " + uri + " " + http_mode + "\r\n", numwritten);
+  std::string request = "GET " + uri + " " + http_mode + "\r\n";
   if (http_mode == "HTTP/1.1") {
-    Write(fd, "Host: " + hostname + "\r\n", numwritten);
+    request += "Host: " + hostname + "\r\n";
   }
-  Write(fd, "\r\n", numwritten);
+  request += "\r\n";
+  Write(fd, request, numwritten);
 }
 
 bool HttpClient::Receive(int fd, const std::string& http_mode, FILE* file,
-                         size_t* numread_total) {
+                         size_t* numread_total, std::vector<char>* pending,
+                         timeval* first_byte, bool* complete) {
 
   std::string crlfcrlf = "\r\n\r\n";
   std::vector<char> bytes;
-  size_t body_offset;
+  size_t body_offset = 0;
   bool body = false;
-  size_t content_length;
+  size_t content_length = 0;
   bool content_length_read = false;
+  bool eof = false;
+
+  if (pending != NULL && !pending->empty()) {
+    bytes.swap(*pending);
+    if (first_byte != NULL)
+      gettimeofday(first_byte, NULL);
+  }
+
+  size_t count = bytes.size();
   while (true) {
-    char buf[10];
-    size_t count = sizeof(buf);
-    if (content_length_read) {
-      size_t remaining = content_length - (bytes.size() - body_offset);
-      count = std::min(count, remaining);
+    if (!body && count > 0) {
+      std::vector<char>::iterator body_begin;
+      if (Search(count, bytes, crlfcrlf, &body_begin)) {
+        body_offset = body_begin - bytes.begin();
+        body = true;
+        std::vector<char>::iterator content_length_begin;
+        if (Search(bytes.size(), bytes, "Content-Length: ",
+                   &content_length_begin) &&
+            (size_t)(content_length_begin - bytes.begin()) <= body_offset) {
+          std::vector<char>::iterator content_length_end = std::search(
+              content_length_begin, bytes.end(),
+              crlfcrlf.begin(), crlfcrlf.begin() + 2);
+          std::string content_length_str(content_length_begin,
+                                         content_length_end);
+          int content_length_int;
+          if (sscanf(content_length_str.c_str(), "%d",
+                     &content_length_int) == 1) {
+            content_length = content_length_int;
+            content_length_read = true;
+          }
+        }
+        // Error responses from the server carry no body.
+        if (!content_length_read)
+          content_length_read = true;
+      }
     }
-    ssize_t numread = read(fd, buf, count);
+
+    if (content_length_read &&
+        bytes.size() - body_offset >= content_length)
+      break;
+
+    char buf[4096];
+    ssize_t numread = read(fd, buf, sizeof(buf));
     if (numread == -1)
       throw errno;
-    if (numread == 0)
+    if (numread == 0) {
+      eof = true;
       break;
+    }
 
+    if (first_byte != NULL && bytes.empty())
+      gettimeofday(first_byte, NULL);
     if (numread_total != NULL)
       *numread_total += numread;
-    for (int i = 0; i < numread; ++i) {
-      bytes.push_back(buf[i]);
-    }
-
-    if (body)
-      continue;
-
-    std::vector<char>::iterator body_begin;
-    if (Search(count, bytes, crlfcrlf, &body_begin)) {
-      body_offset = body_begin - bytes.begin();
-      body = true;
-      std::vector<char>::iterator content_length_begin;
-      if (!Search(bytes.size(), bytes, "Content-Length: ",
-                  &content_length_begin)) {
-        fprintf(stderr, "Error: Missing Content-Length");
-        break;
-      }
-
-      std::vector<char>::iterator content_length_end = std::search(
-          content_length_begin, bytes.end(),
-          crlfcrlf.begin(), crlfcrlf.begin() + 2);
-      std::string content_length_str(content_length_begin, content_length_end);
-      int content_length_int;
-      if (sscanf(content_length_str.c_str(), "%d", &content_length_int) == 1) {
-        content_length = content_length_int;
-        content_length_read = true;
-      }
-    }
+    bytes.insert(bytes.end(), buf, buf + numread);
+    count = numread;
   }
 
+  if (complete != NULL)
+    *complete = body && bytes.size() - body_offset >= content_length;
   if (body) {
-    std::string header(bytes.begin(), bytes.begin() + body_offset);
-    //pthread_mutex_lock(&connect_times_mutex);
-    //fprintf(stderr, "%ld %s", (long)pthread_self(), header.c_str());
-    //pthread_mutex_unlock(&connect_times_mutex);
+    size_t body_length = std::min(content_length,
+                                  bytes.size() - body_offset);
+    if (body_length > 0)
+      fwrite(&*(bytes.begin() + body_offset), 1, body_length, file);
 
-    fwrite(&*(bytes.begin() + body_offset), 1, bytes.size() - body_offset,
-           file);
+    if (pending != NULL)
+      pending->assign(bytes.begin() + body_offset + body_length, bytes.end());
   }
 
 
   std::vector<char>::iterator it;
-  if (http_mode == "HTTP/1.0" ||
+  if (eof || http_mode == "HTTP/1.0" ||
       (Search(bytes.size(), bytes, "Connection: close\r\n", &it) &&
        (size_t)(it - bytes.begin()) <= body_offset)) {
     close(fd);
@@ -254,12 +303,52 @@ bool HttpClient::Receive(int fd, const std::string& http_mode, FILE* file,
   return false;
 }
 
+namespace {
+
+struct InFlight {
+  timeval sent;
+  size_t traffic;
+};
+
+struct PooledConnection {
+  int fd;
+  // responses received; a server may close a reused connection while
+  // it is idle, e.g. when it drains for an upgrade
+  int responses;
+  std::vector<char> pending;
+  std::deque<InFlight> in_flight;
+
+  PooledConnection() : fd(-1), responses(0) {}
+};
+
+// Whether |bytes| already holds a whole response, which poll() won't
+// report once the server has sent everything.
+bool HasResponse(std::vector<char>& bytes) {
+  std::vector<char>::iterator body_begin;
+  if (!Search(bytes.size(), bytes, "\r\n\r\n", &body_begin))
+    return false;
+  size_t body_offset = body_begin - bytes.begin();
+  size_t content_length = 0;
+  std::vector<char>::iterator it;
+  if (Search(bytes.size(), bytes, "Content-Length: ", &it) &&
+      (size_t)(it - bytes.begin()) <= body_offset) {
+    int length;
+    std::string digits(it, std::find(it, body_begin, '\r'));
+    if (sscanf(digits.c_str(), "%d", &length) == 1)
+      content_length = length;
+  }
+  return bytes.size() - body_offset >= content_length;
+}
+
+}
+
 void* Download(void* arg) {
   HttpClient* http_client = (HttpClient*)arg;
   const std::string& hostname = http_client->hostname;
   const std::string& http_mode = http_client->http_mode;
   const std::string& uri = http_client->uri;
   int numrequests = http_client->numrequests;
+  size_t pipeline_depth = http_client->pipeline_depth;
 
   if (mkdir(DOWNLOAD_DIR, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) &&
       errno != EEXIST) {
@@ -267,47 +356,158 @@ void* Download(void* arg) {
     return NULL;
   }
 
-  int sockfd;
-  bool connection_closed = true;
-  for (int i = 0; i < numrequests; ++i) {
-    if (connection_closed)
-      sockfd = http_client->Connect();
-
-    timeval download_start;
-    gettimeofday(&download_start, NULL);
-    size_t traffic = 0;
-
-    std::string path = uri;
-    std::replace(path.begin() + 1, path.end(), '/', '_');
-    path = DOWNLOAD_DIR + path;
-    FILE* file = fopen(path.c_str(), "w");
-    http_client->Request(sockfd, uri, http_mode, hostname, &traffic);
-    connection_closed = http_client->Receive(sockfd, http_mode, file,
-                                             &traffic);
-    fclose(file);
-
-    timeval download_end;
-    gettimeofday(&download_end, NULL);
-    long download_time =  (long)(
-        (download_end.tv_sec - download_start.tv_sec) * 1000000L +
-        download_end.tv_usec - download_start.tv_usec);
-    long long throughput = traffic * 1000000LL / download_time;
-
-    pthread_mutex_lock(&throughputs_mutex);
-    throughputs.push_back(throughput);
-    pthread_mutex_unlock(&throughputs_mutex);
+  std::string path = uri;
+  std::replace(path.begin() + 1, path.end(), '/', '_');
+  path = DOWNLOAD_DIR + path;
+
+  std::vector<PooledConnection> pool(http_client->numconnections);
+  std::vector<pollfd> pollfds;
+  std::vector<size_t> polled;
+  int issued = 0;
+  int completed = 0;
+  while (completed < numrequests) {
+    // keep every pooled connection's pipeline full
+    for (size_t i = 0; i < pool.size(); ++i) {
+      PooledConnection& conn = pool[i];
+      while (issued < numrequests && conn.in_flight.size() < pipeline_depth) {
+        if (conn.fd == -1) {
+          conn.fd = http_client->Connect();
+          conn.responses = 0;
+        }
+
+        InFlight request;
+        request.traffic = 0;
+        gettimeofday(&request.sent, NULL);
+        try {
+          http_client->Request(conn.fd, uri, http_mode, hostname,
+                               &request.traffic);
+        } catch (int error_num) {
+          if (conn.responses == 0 ||
+              (error_num != EPIPE && error_num != ECONNRESET))
+            throw;
+          // closed while idle; send again on a new connection
+          close(conn.fd);
+          issued -= conn.in_flight.size();
+          conn.in_flight.clear();
+          conn.pending.clear();
+          conn.fd = -1;
+          continue;
+        }
+        conn.in_flight.push_back(request);
+        ++issued;
+      }
+    }
+
+    pollfds.clear();
+    polled.clear();
+    std::vector<bool> buffered;
+    int timeout = -1;
+    for (size_t i = 0; i < pool.size(); ++i) {
+      if (pool[i].in_flight.empty())
+        continue;
+      pollfd p;
+      p.fd = pool[i].fd;
+      p.events = POLLIN;
+      p.revents = 0;
+      pollfds.push_back(p);
+      polled.push_back(i);
+      buffered.push_back(HasResponse(pool[i].pending));
+      if (buffered.back())
+        timeout = 0;
+    }
+    if (poll(&pollfds[0], pollfds.size(), timeout) == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      return NULL;
+    }
+
+    for (size_t j = 0; j < pollfds.size(); ++j) {
+      if (pollfds[j].revents == 0 && !buffered[j])
+        continue;
+      PooledConnection& conn = pool[polled[j]];
+      InFlight request = conn.in_flight.front();
+      conn.in_flight.pop_front();
+
+      timeval first_byte = request.sent;
+      FILE* file = fopen(path.c_str(), "w");
+      bool complete = false;
+      bool connection_closed;
+      try {
+        connection_closed = http_client->Receive(
+            conn.fd, http_mode, file, &request.traffic, &conn.pending,
+            &first_byte, &complete);
+      } catch (int error_num) {
+        if (conn.responses == 0 || error_num != ECONNRESET)
+          throw;
+        close(conn.fd);
+        connection_closed = true;
+      }
+      fclose(file);
+
+      if (!complete && conn.responses > 0) {
+        // the server closed the reused connection before answering; send
+        // this request and the ones behind it again
+        issued -= conn.in_flight.size() + 1;
+        conn.in_flight.clear();
+        conn.pending.clear();
+        conn.fd = -1;
+        continue;
+      }
+      ++conn.responses;
+
+      timeval download_end;
+      gettimeofday(&download_end, NULL);
+      long download_time = ElapsedMicros(request.sent, download_end);
+      if (download_time <= 0)
+        download_time = 1;
+      long long throughput = request.traffic * 1000000LL / download_time;
+
+      pthread_mutex_lock(&throughputs_mutex);
+      throughputs.push_back(throughput);
+      ttfb_times.push_back(ElapsedMicros(request.sent, first_byte));
+      transfer_times.push_back(ElapsedMicros(first_byte, download_end));
+      pthread_mutex_unlock(&throughputs_mutex);
+      ++completed;
+
+      if (connection_closed) {
+        // requests pipelined behind a close are sent again
+        issued -= conn.in_flight.size();
+        conn.in_flight.clear();
+        conn.pending.clear();
+        conn.fd = -1;
+      }
+    }
   }
 
-  if (!connection_closed)
-    close(sockfd);
+  for (size_t i = 0; i < pool.size(); ++i) {
+    if (pool[i].fd != -1)
+      close(pool[i].fd);
+  }
 
   return NULL;
 }
 
+namespace {
+
+template <typename T>
+T Average(const std::vector<T>& values) {
+  if (values.empty())
+    return 0;
+  return std::accumulate(values.begin(), values.end(), (T)0) /
+      (T)values.size();
+}
+
+}
+
 void HttpClient::DownloadAll() {
+  // a write to a connection the server closed fails with EPIPE instead
+  signal(SIGPIPE, SIG_IGN);
   pthread_mutex_init(&connect_times_mutex, NULL);
   pthread_mutex_init(&throughputs_mutex, NULL);
 
+  Resolve();
+
   pthread_t threads[numthreads];
 
   for (int i = 0; i < numthreads; ++i) {
@@ -325,16 +525,17 @@ void HttpClient::DownloadAll() {
   }
 
 
-  long connect_time = std::accumulate(
-      connect_times.begin(), connect_times.end(), 0L) / connect_times.size();
-  long long throughput = std::accumulate(
-      throughputs.begin(), throughputs.end(), 0LL) / throughputs.size();
-  printf("%10ld\t%19lld\n", connect_time, throughput);
+  // connect and throughput first, then per-phase times in microseconds
+  printf("%10ld\t%19lld\t%10ld\t%10ld\n",
+         Average(connect_times), Average(throughputs),
+         Average(ttfb_times), Average(transfer_times));
 
 
 
   connect_times.clear();
   throughputs.clear();
+  ttfb_times.clear();
+  transfer_times.clear();
   pthread_mutex_destroy(&connect_times_mutex);
   pthread_mutex_destroy(&throughputs_mutex);
 }
@@ -22,7 +22,13 @@
 #ifndef HTTP_CLIENT_HPP_
 #define HTTP_CLIENT_HPP_
 
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <cstdio>
 #include <string>
+#include <vector>
 
 class HttpClient {
  public:
@@ -32,16 +38,28 @@ class HttpClient {
   std::string uri;
   int numrequests;
   int numthreads;
+  int numconnections;
+  int pipeline_depth;
+  sockaddr_storage address;
+  socklen_t address_len;
+  // connect with TCP Fast Open; HTTP_CLIENT_FASTOPEN=1 in the environment
+  bool fastopen;
 
   HttpClient(int argc, char* argv[]);
+  void Resolve();
   int Connect();
   void DownloadAll();
   static void Request(int fd, const std::string& uri,
                       const std::string& http_mode,
                       const std::string& hostname,
                       size_t* numwritten = NULL);
+  // Returns whether the connection was closed; |complete| tells whether
+  // a whole response arrived before that.
   static bool Receive(int fd, const std::string& http_mode, FILE *file,
-                      size_t* numread = NULL);
+                      size_t* numread = NULL,
+                      std::vector<char>* pending = NULL,
+                      timeval* first_byte = NULL,
+                      bool* complete = NULL);
 };
 
 #endif
@@ -0,0 +1,304 @@
+/*
+ * http_request.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <exception>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "http_request.hpp"
+#include "probes.hpp"
+
+ssize_t Write(int fd, const char* data, size_t length) {
+  size_t ret = 0;
+  while (ret < length) {
+    ssize_t cnt = write(fd, data + ret, length - ret);
+    if (cnt == 0)
+      break;
+    if (cnt == -1) {
+      int error_num = errno;
+      if (error_num == EINTR)
+        continue;
+      if (error_num != EPIPE)
+        perror("write");
+      throw error_num;
+    }
+    ret += cnt;
+  }
+  return ret;
+}
+
+ssize_t Write(int fd, const std::string& s) {
+  return Write(fd, s.data(), s.length());
+}
+
+off_t SendFile(int fd, int file, off_t offset, off_t length) {
+  off_t start = offset;
+  length += offset;
+  while (offset < length) {
+    ssize_t cnt = sendfile(fd, file, &offset, length - offset);
+    if (cnt == 0)
+      break;
+    if (cnt == -1) {
+      int error_num = errno;
+      if (error_num == EINTR)
+        continue;
+      if (error_num == EINVAL || error_num == ENOSYS)
+        break;
+      if (error_num != EPIPE && error_num != ECONNRESET)
+        perror("sendfile");
+      throw error_num;
+    }
+  }
+
+  // sendfile can't write to this kind of descriptor; copy instead
+  char buf[16384];
+  while (offset < length) {
+    ssize_t numread = pread(file, buf, sizeof(buf), offset);
+    if (numread <= 0)
+      break;
+    Write(fd, buf, numread);
+    offset += numread;
+  }
+  return offset - start;
+}
+
+void EndHeaders(int fd, const std::string& http_version,
+                const std::string& http_mode) {
+  if (http_mode == "HTTP/1.0" && http_version == "HTTP/1.1") {
+    Write(fd, "Connection: close\r\n");
+  }
+  Write(fd, "\r\n");
+  HTTPD_PROBE1(headers__sent, fd);
+}
+
+bool EndResponse(int fd, const std::string& http_mode) {
+  if (http_mode == "HTTP/1.0") {
+    HTTPD_PROBE1(connection__close, fd);
+    close(fd);
+  }
+  return true;
+}
+
+std::string ReplaceString(std::string subject, const std::string& search,
+                          const std::string& replace) {
+  size_t pos = 0;
+  while ((pos = subject.find(search, pos)) != std::string::npos) {
+    subject.replace(pos, search.length(), replace);
+    pos += replace.length();
+  }
+  return subject;
+}
+
+HttpRequest::HttpRequest() : bad(true), trans_time(0) {
+}
+
+size_t FindHeaderEnd(const std::string& s, size_t from) {
+  static const std::string crlfcrlf = "\r\n\r\n";
+  from = from < crlfcrlf.length() ? 0 : from - (crlfcrlf.length() - 1);
+  size_t pos = s.find(crlfcrlf, from);
+  if (pos == std::string::npos)
+    return pos;
+  return pos + crlfcrlf.length();
+}
+
+bool HttpRequest::Read(int fd, std::string* pending) {
+  const size_t buf_len = 4096;
+  char buf[buf_len];
+  ssize_t numread;
+
+  // bytes left over from the previous request may hold pipelined requests
+  std::string request_string;
+  request_string.swap(*pending);
+  size_t header_end = FindHeaderEnd(request_string, 0);
+  if (!request_string.empty())
+    HTTPD_PROBE1(first__byte, fd);
+  while (header_end == std::string::npos) {
+    numread = read(fd, &buf, buf_len);
+    if (numread == -1) {
+      // perror may clobber errno, and an idle keep-alive timeout is routine;
+      // so is EIO from a kernel TLS socket when the peer sends an alert.
+      // SO_RCVTIMEO keeps SA_RESTART from restarting the read
+      int error_num = errno;
+      if (error_num == EINTR)
+        continue;
+      if (error_num != EPIPE && error_num != EAGAIN && error_num != EIO)
+        perror("read");
+      throw error_num;
+    }
+    if (numread == 0)
+      break;
+
+    size_t from = request_string.length();
+    if (from == 0)
+      HTTPD_PROBE1(first__byte, fd);
+    request_string.append(buf, numread);
+    header_end = FindHeaderEnd(request_string, from);
+  }
+
+  if (header_end != std::string::npos) {
+    pending->assign(request_string, header_end, std::string::npos);
+    request_string.resize(header_end);
+  }
+
+  bad = false;
+
+  std::istringstream iss(request_string);
+  iss >> method >> uri >> http_mode;
+  ParseHeaders(request_string, request_string.find("\r\n"), &headers);
+  HTTPD_PROBE3(request__parsed, fd, method.c_str(), uri.c_str());
+
+  if (method != "GET" &&
+      method != "OPTIONS" &&
+      method != "HEAD" &&
+      method != "POST" &&
+      method != "PUT" &&
+      method != "DELETE" &&
+      method != "TRACE" &&
+      method != "CONNECT") {
+    bad = true;
+  } else if (uri.empty()) {
+    bad = true;
+  } else if (uri[0] != '/' && uri[0] != '*' &&
+             uri.find("http://") == std::string::npos &&
+             uri.find("https://") == std::string::npos &&
+             method != "CONNECT") {
+    bad = true;
+  } else if (http_mode != "HTTP/1.0" && http_mode != "HTTP/1.1")
+    bad = true;
+
+  return true;
+}
+
+void ParseHeaders(const std::string& block, size_t from,
+                  std::vector<std::pair<std::string, std::string> >* headers) {
+  while (from != std::string::npos && from < block.length()) {
+    size_t begin = from + 2;
+    size_t end = block.find("\r\n", begin);
+    if (end == std::string::npos || end == begin)
+      break;
+    from = end;
+
+    size_t colon = block.find(':', begin);
+    if (colon == std::string::npos || colon > end)
+      continue;
+    size_t value = block.find_first_not_of(" \t", colon + 1);
+    if (value == std::string::npos || value > end)
+      value = end;
+    headers->push_back(std::make_pair(block.substr(begin, colon - begin),
+                                      block.substr(value, end - value)));
+  }
+}
+
+bool EqualsIgnoreCase(const std::string& a, const std::string& b) {
+  return a.length() == b.length() &&
+      strncasecmp(a.c_str(), b.c_str(), a.length()) == 0;
+}
+
+std::string HttpRequest::GetHeader(const std::string& name) const {
+  for (size_t i = 0; i < headers.size(); ++i) {
+    if (EqualsIgnoreCase(headers[i].first, name))
+      return headers[i].second;
+  }
+  return "";
+}
+
+int OpenFile(const std::string& http_root, const std::string& uri, int* fd,
+             off_t* size) {
+  std::string path;
+  if (ResolvePath(http_root, uri, &path) != 200)
+    return 400;
+  struct stat statbuf;
+  int status = OpenPath(path, fd, &statbuf);
+  if (status == 200)
+    *size = statbuf.st_size;
+  return status;
+}
+
+int ResolvePath(const std::string& http_root, const std::string& uri,
+                std::string* path) {
+  try {
+    *path = PathFromUri(uri);
+  } catch (std::exception&) {
+    return 400;
+  }
+  if (*path == "/")
+    *path += "index.html";
+  *path = http_root + ReplaceString(*path, std::string("%20"), " ");
+  return 200;
+}
+
+int OpenPath(const std::string& path, int* fd, struct stat* statbuf) {
+  *fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (*fd == -1) {
+    switch (errno) {
+      case ENOENT:
+      case ENOTDIR:
+        return 404;
+      case EACCES:
+        return 403;
+      default:
+        perror("open");
+        throw errno;
+    }
+  }
+
+  if (fstat(*fd, statbuf) == -1) {
+    int error_num = errno;
+    close(*fd);
+    perror("fstat");
+    throw error_num;
+  }
+  if (S_ISDIR(statbuf->st_mode)) {
+    close(*fd);
+    return 403;
+  }
+  return 200;
+}
+
+std::string PathFromUri(const std::string& uri) {
+  const std::string separator = "://";
+  size_t index_from = uri.find(separator);
+  if (index_from != std::string::npos) {
+    index_from += separator.length();
+  } else {
+    index_from = 0;
+  }
+
+  size_t path_from = uri.find("/", index_from);
+  if (path_from == std::string::npos)
+    throw std::exception();
+
+  return uri.substr(path_from);
+}
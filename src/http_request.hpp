@@ -0,0 +1,88 @@
+/*
+ * http_request.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP_REQUEST_HPP_
+#define HTTP_REQUEST_HPP_
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+struct HttpRequest {
+  std::string method;
+  std::string uri;
+  std::string http_mode;
+  std::vector<std::pair<std::string, std::string> > headers;
+  bool bad;
+  long trans_time;
+
+  HttpRequest();
+
+  // Value of the first header named |name| (case-insensitive), or "".
+  std::string GetHeader(const std::string& name) const;
+
+  bool Read(int fd, std::string* pending);
+};
+
+ssize_t Write(int fd, const char* data, size_t length);
+ssize_t Write(int fd, const std::string& s);
+
+// Sends |length| bytes of |file| from |offset| with sendfile, falling
+// back to read/write where sendfile isn't supported.  Returns the bytes
+// sent.
+off_t SendFile(int fd, int file, off_t offset, off_t length);
+
+void EndHeaders(int fd, const std::string& http_version,
+                const std::string& http_mode);
+
+bool EndResponse(int fd, const std::string& http_mode);
+
+std::string ReplaceString(std::string subject, const std::string& search,
+                          const std::string& replace);
+
+// Returns the offset just past the first "\r\n\r\n" in |s|, only looking
+// at data appended at or after |from|, or npos when there is none yet.
+size_t FindHeaderEnd(const std::string& s, size_t from);
+
+// Appends the "Name: value" lines of |block| that follow the CRLF at
+// |from| (the end of the request or status line) up to the blank line.
+void ParseHeaders(const std::string& block, size_t from,
+                  std::vector<std::pair<std::string, std::string> >* headers);
+
+bool EqualsIgnoreCase(const std::string& a, const std::string& b);
+
+// Opens the file |uri| names under |http_root|.  Returns the HTTP status:
+// 200 with |fd| and |size| set, or 400, 403 or 404.
+int OpenFile(const std::string& http_root, const std::string& uri, int* fd,
+             off_t* size);
+
+// The two halves of OpenFile: the file name |uri| maps to (200 or 400),
+// and opening it (200, 403 or 404, with |statbuf| filled in).
+int ResolvePath(const std::string& http_root, const std::string& uri,
+                std::string* path);
+int OpenPath(const std::string& path, int* fd, struct stat* statbuf);
+
+std::string PathFromUri(const std::string& uri);
+
+#endif
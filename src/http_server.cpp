@@ -20,279 +20,247 @@
  */
 
 #include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <exception>
-#include <sstream>
 #include <string>
-
+#include <vector>
+
+#include "admission.hpp"
+#include "bandwidth.hpp"
+#include "content_cache.hpp"
+#include "hot_paths.hpp"
+#include "http2.hpp"
+#include "http_request.hpp"
 #include "http_server.hpp"
+#include "preload.hpp"
+#include "profiler.hpp"
+#include "probes.hpp"
+#include "proxy.hpp"
+#include "router.hpp"
+#include "tls.hpp"
+#include "upload.hpp"
 
 #define DEFAULT_PORT 8080
 #define DEFAULT_TIMEOUT 300
+// a re-executed server finds its listener and hot path table in these
+#define LISTEN_FD_ENV "MYHTTPD_LISTEN_FD"
+#define HOT_PATHS_FD_ENV "MYHTTPD_HOT_PATHS_FD"
+// how often a waiting accept wakes for periodic work
+#define ACCEPT_POLL_MS 1000
+#define MANIFEST_PATHS 1024
 
 using namespace std;
 
 namespace {
 
-struct HttpRequest {
-  std::string method;
-  std::string uri;
-  std::string http_mode;
-  bool bad;
-  long trans_time;
-
-  HttpRequest();
-
-  bool Read(int fd);
-  bool Respond(int fd, const std::string& http_root,
-               const std::string& http_version);
-};
-
-bool EndsWithTwoNewLines(const std::string& s);
-
-std::string PathFromUri(const std::string& uri);
+pthread_mutex_t trans_times_mutex;
 
-ssize_t Write(int fd, const std::string& s) {
-  ssize_t ret = 0;
-  while (true) {
-    ssize_t cnt = write(fd, s.c_str() + ret, s.length() - ret);
-    if (cnt == 0)
-      break;
-    if (cnt == -1) {
-      if (errno != EPIPE)
-        perror("write");
-      throw errno;
-    }
-    ret += cnt;
+// set by SIGUSR2: hand the listener to a new binary and finish up
+volatile sig_atomic_t draining = 0;
+// becomes readable with the drain, waking every thread that waits on a
+// listener or an idle connection; each worker process makes its own
+int drain_fd = -1;
+// bumped in each forked child, whose inherited epoll sets are stale
+unsigned fork_generation = 0;
+
+void OnUpgradeSignal(int signum) {
+  int saved_errno = errno;
+  draining = 1;
+  uint64_t one = 1;
+  if (write(drain_fd, &one, sizeof(one)) == -1) {
+    // the counter only has to be nonzero
   }
-  return ret;
+  errno = saved_errno;
 }
 
-void EndHeaders(int fd, const std::string& http_version,
-                const std::string& http_mode) {
-  if (http_mode == "HTTP/1.0" && http_version == "HTTP/1.1") {
-    Write(fd, "Connection: close\r\n");
+void CancelDrain() {
+  draining = 0;
+  uint64_t count;
+  if (read(drain_fd, &count, sizeof(count)) == -1) {
+    // already clear
   }
-  Write(fd, "\r\n");
 }
 
-bool EndResponse(int fd, const std::string& http_mode) {
-  if (http_mode == "HTTP/1.0")
-    close(fd);
-  return true;
+int CreateDrainFd() {
+  int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (fd == -1) {
+    perror("eventfd");
+    throw exception();
+  }
+  return fd;
 }
 
-std::string ReplaceString(std::string subject, const std::string& search,
-                          const std::string& replace) {
-  size_t pos = 0;
-  while ((pos = subject.find(search, pos)) != std::string::npos) {
-    subject.replace(pos, search.length(), replace);
-    pos += replace.length();
-  }
-  return subject;
+void OnFork() {
+  close(drain_fd);
+  drain_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  ++fork_generation;
 }
 
-HttpRequest::HttpRequest() : bad(true), trans_time(0) {
+void HandleUpgradeSignal(int flags) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = OnUpgradeSignal;
+  action.sa_flags = flags;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR2, &action, NULL);
 }
 
-bool HttpRequest::Read(int fd) {
-  const size_t buf_len = 10;
-  char buf[buf_len];
-  ssize_t numread;
+// Takes the descriptor a previous server left in the environment.
+int InheritedFd(const char* name) {
+  const char* value = getenv(name);
+  if (value == NULL)
+    return -1;
+  int fd = atoi(value);
+  unsetenv(name);
+  if (fd <= 2 || fcntl(fd, F_GETFD) == -1)
+    return -1;
+  return fd;
+}
 
-  std::string request_string;
-  do {
-    numread = read(fd, &buf, buf_len);
-    if (numread == -1) {
-      if (errno != EPIPE)
-        perror("read");
-      throw errno;
-    }
+long ElapsedMicros(const timeval& from, const timeval& to) {
+  return (long)((to.tv_sec - from.tv_sec) * 1000000L +
+                to.tv_usec - from.tv_usec);
+}
 
-    for (int i = 0; i < numread; ++i) {
-      request_string.push_back(buf[i]);
-    }
-  } while (numread && !EndsWithTwoNewLines(request_string));
-
-  bad = false;
-
-  std::istringstream iss(request_string);
-  iss >> method >> uri >> http_mode;
-
-  if (method != "GET" &&
-      method != "OPTIONS" &&
-      method != "HEAD" &&
-      method != "POST" &&
-      method != "PUT" &&
-      method != "DELETE" &&
-      method != "TRACE" &&
-      method != "CONNECT") {
-    bad = true;
-  } else if (uri.empty()) {
-    bad = true;
-  } else if (uri[0] != '/' && uri[0] != '*' &&
-             uri.find("http://") == std::string::npos &&
-             uri.find("https://") == std::string::npos &&
-             method != "CONNECT") {
-    bad = true;
-  } else if (http_mode != "HTTP/1.0" && http_mode != "HTTP/1.1")
-    bad = true;
+// Time the connection spent in the listen backlog: for a socket that has
+// not been read yet this is the time since its request (or, with no
+// request yet, its handshake) arrived.
+long BacklogMicros(int fd) {
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1)
+    return 0;
+  return info.tcpi_last_data_recv * 1000L;
+}
 
-  return true;
+void Reject(int fd, const std::string& response) {
+  // consume what the client already sent so close doesn't reset the
+  // connection before it reads the response
+  char buf[4096];
+  recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+  if (!response.empty())
+    send(fd, response.c_str(), response.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
+  HTTPD_PROBE1(connection__close, fd);
+  close(fd);
 }
 
-bool HttpRequest::Respond(int fd, const std::string& http_root,
-                          const std::string& http_mode) {
-  if (bad) {
-    Write(fd, http_mode + " 400 Bad Request\r\n");
-    EndHeaders(fd, this->http_mode, http_mode);
-    return EndResponse(fd, http_mode);
+// Small JSON health report for load balancers and monitoring.
+class StatusHandler : public HttpHandler {
+ public:
+  explicit StatusHandler(const HttpServer* server)
+      : server(server), preloader(server->GetPreloader()),
+        started(time(NULL)) {
   }
 
-  if (method != "GET") {
-    Write(fd, http_mode + " 501 Not Implemented\r\n");
-    EndHeaders(fd, this->http_mode, http_mode);
-    return EndResponse(fd, http_mode);
+  void Handle(const HttpRequest& req, const RouteMatch& match,
+              ResponseWriter* response) {
+    char cache_stats[96] = "";
+    const ContentCache* cache = server->GetContentCache();
+    if (cache != NULL)
+      snprintf(cache_stats, sizeof(cache_stats),
+               ",\"cache_hits\":%llu,\"cache_misses\":%llu",
+               (unsigned long long)cache->Hits(),
+               (unsigned long long)cache->Misses());
+
+    char status[384];
+    snprintf(status, sizeof(status),
+             "{\"status\":\"ok\",\"pid\":%d,\"mode\":\"%s\",\"port\":%d,"
+             "\"uptime_s\":%ld,\"warmup_ms\":%ld,\"preloaded_bytes\":%lld,"
+             "\"locked_bytes\":%lld%s}\n", (int)getpid(),
+             server->http_mode.c_str(), server->port,
+             (long)(time(NULL) - started), preloader->Micros() / 1000,
+             preloader->BytesRead(), preloader->BytesLocked(), cache_stats);
+    response->AddHeader("Content-Type", "application/json");
+    response->AddHeader("Cache-Control", "no-store");
+    response->Write(status);
   }
 
+ private:
+  const HttpServer* server;
+  const Preloader* preloader;
+  time_t started;
+};
 
-  std::string path = PathFromUri(uri);
-  if (path == "/")
-    path += "index.html";
-  path = http_root + ReplaceString(path, std::string("%20"), " "); // create appr URI
-
+}
 
-  FILE* file = fopen(path.c_str(), "r");
-  if (file == NULL) {
-    switch (errno) {
-      case ENOENT:
-      case ENOTDIR:
-        Write(fd, http_mode + " 404 Not Found\r\n");
-        EndHeaders(fd, this->http_mode, http_mode);
-        return EndResponse(fd, http_mode);
-      case EACCES:
-        Write(fd, http_mode + " 403 Forbidden\r\n");
-        EndHeaders(fd, this->http_mode, http_mode);
-        return EndResponse(fd, http_mode);
-      default:
-        perror("fopen");
-        throw errno;
+bool HttpServer::Admit(int fd, const timeval& accepted) {
+  if (rate_limiter != NULL) {
+    sockaddr_in address;
+    socklen_t len = sizeof(address);
+    if (getpeername(fd, (sockaddr*)&address, &len) == 0 &&
+        address.sin_family == AF_INET &&
+        !rate_limiter->Allow(ntohl(address.sin_addr.s_addr))) {
+      Reject(fd, rate_limited_response);
+      return false;
     }
-  } // Open file
-
-
-  struct stat statbuf;
-  if (stat(path.c_str(), &statbuf) == -1) {
-    fclose(file);
-    perror("stat");
-    throw errno;
-  } // send 403
-  if (S_ISDIR(statbuf.st_mode)) {
-    fclose(file);
-    Write(fd, http_mode + " 403 Forbidden\r\n");
-    EndHeaders(fd, this->http_mode, http_mode);
-    return EndResponse(fd, http_mode);
   }
 
-
-  if (fseek(file, 0, SEEK_END) != 0) {
-    fclose(file);
-    Write(fd, http_mode + " 403 Forbidden\r\n");
-    EndHeaders(fd, this->http_mode, http_mode);
-    return EndResponse(fd, http_mode);
-  } // len of file
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-
-  Write(fd, http_mode + " 200 OK\r\n");
-
-  timeval trans_start;
-  gettimeofday(&trans_start, NULL);
-
-
-  char content_length_str[32];
-  sprintf(content_length_str, "Content-Length: %ld\r\n", file_size);
-  Write(fd, content_length_str);
-
-  EndHeaders(fd, this->http_mode, http_mode);
-
-
-  try {
-    while (!feof(file)) {
-      size_t buf_len = 10;
-      char buf[buf_len + 1];
-      size_t numread = fread(&buf, 1, buf_len, file);
-      write(fd, &buf, numread);
+  if (admission != NULL) {
+    timeval now;
+    gettimeofday(&now, NULL);
+    long sojourn = BacklogMicros(fd) + ElapsedMicros(accepted, now);
+    if (admission->ShouldShed(sojourn)) {
+      Reject(fd, overloaded_response);
+      return false;
     }
-  } catch (int error_num) {
-    fclose(file);
-    throw error_num;
-  } // reading file for client : done
-
-  timeval trans_end;
-  gettimeofday(&trans_end, NULL);
-  trans_time =  (long)(
-      (trans_end.tv_sec - trans_start.tv_sec) * 1000000L +
-      trans_end.tv_usec - trans_start.tv_usec);
-
-  fclose(file);
-
-  return EndResponse(fd, http_mode);
-}
-
-bool EndsWithTwoNewLines(const std::string& s) {
-  static const std::string crlfcrlf = "\r\n\r\n";
-  if (s.length() < crlfcrlf.length())
-    return false;
-
-  std::string lastFourChars(s.end() - crlfcrlf.length(), s.end());
-  return lastFourChars == crlfcrlf;
-}
-
-std::string PathFromUri(const std::string& uri) {
-  const std::string separator = "://";
-  size_t index_from = uri.find(separator);
-  if (index_from != std::string::npos) {
-    index_from += separator.length();
-  } else {
-    index_from = 0;
   }
 
-  size_t path_from = uri.find("/", index_from);
-  if (path_from == std::string::npos)
-    throw std::exception();
-
-  return uri.substr(path_from);
+  return true;
 }
 
+void HttpServer::Shed(int fd) {
+  Reject(fd, overloaded_response);
 }
 
-namespace {
-
-pthread_mutex_t trans_times_mutex;
+void HttpServer::ProcessRequest(int fd) {
+  if (incoming_cpu)
+    SteerToIncomingCpu(fd);
+  if (tls == NULL) {
+    ServeConnection(fd);
+    return;
+  }
 
+  TlsConnection connection(tls, fd);
+  fd = connection.Handshake();
+  if (fd == -1)
+    return;
+  SetReceiveTimeout(fd);
+  ServeConnection(fd);
 }
 
-void HttpServer::ProcessRequest(int fd) {
-  while (true) {
+void HttpServer::ServeConnection(int fd) {
+  std::string pending;
+  SendPacer pacer(bandwidth);
+  for (bool first = true; ; first = false) {
     HttpRequest req;
 
+    if (!first && pending.empty() && !AwaitRequest(fd))
+      return;
     try {
-      req.Read(fd);
+      req.Read(fd, &pending);
     } catch(int error_num) {
+      HTTPD_PROBE1(connection__close, fd);
       if (close(fd) == -1)
         perror("close");
 
@@ -303,9 +271,45 @@ void HttpServer::ProcessRequest(int fd) {
       throw error_num;
     }
 
+    if (h2c && ((req.method == "PRI" && req.uri == "*" &&
+                 req.http_mode == "HTTP/2.0") ||
+                Http2Connection::IsUpgrade(req))) {
+      try {
+        Http2Connection connection(fd, http_root, timeout, bandwidth,
+                                   drain_fd);
+        if (req.method == "PRI")
+          connection.ServePriorKnowledge(&pending);
+        else
+          connection.ServeUpgrade(req, &pending);
+      } catch (int error_num) {
+        HTTPD_PROBE1(connection__close, fd);
+        close(fd);
+        if (error_num == EPIPE || error_num == ECONNRESET)
+          return;
+        throw error_num;
+      }
+      HTTPD_PROBE1(connection__close, fd);
+      close(fd);
+      return;
+    }
+
+    bool open = true;
     try {
-      req.Respond(fd, http_root, http_mode);
+      ProxyRoute* route = NULL;
+      if (proxy != NULL && !req.bad)
+        route = proxy->Match(req.uri);
+
+      if (route == NULL && uploads != NULL && !req.bad &&
+          (req.method == "PUT" || req.method == "POST")) {
+        if (!uploads->Handle(req, fd, &pending, http_root, http_mode))
+          return;
+      } else if (route == NULL) {
+        open = router->Dispatch(&req, fd, http_mode, !Draining(), &pacer);
+      } else if (!proxy->Forward(route, req, fd, &pending, http_mode)) {
+        return;
+      }
     } catch (int error_num) {
+      HTTPD_PROBE1(connection__close, fd);
       if (close(fd) == -1)
         perror("close");
 
@@ -317,20 +321,206 @@ void HttpServer::ProcessRequest(int fd) {
     fflush(stdout);
     pthread_mutex_unlock(&trans_times_mutex);
 
-    if (http_mode == "HTTP/1.0")
+    if (http_mode == "HTTP/1.0" || !open)
+      break;
+    if (Draining()) {
+      // the successor takes the client's next connection
+      HTTPD_PROBE1(connection__close, fd);
+      close(fd);
       break;
+    }
   }
 }
 
 int HttpServer::AcceptConnection() {
+  int fd;
+  if (AcceptConnections(&fd, 1) == -1)
+    return -1;
+  return fd;
+}
 
-  int fd = accept(this->sockfd, NULL, NULL);
-  if (fd == -1) {
-    perror("failed to accept a connection");
-    throw exception();
+bool HttpServer::AwaitRequest(int fd) {
+  // an idle keep-alive connection is closed as soon as a drain starts
+  pollfd p[2];
+  p[0].fd = fd;
+  p[0].events = POLLIN;
+  p[1].fd = drain_fd;
+  p[1].events = POLLIN;
+  int wait_ms = http_mode == "HTTP/1.1" ? timeout * 1000 : -1;
+  int rv;
+  do {
+    p[0].revents = p[1].revents = 0;
+    rv = poll(p, 2, wait_ms);
+  } while (rv == -1 && errno == EINTR && !Draining());
+  if (rv > 0 && p[0].revents != 0)
+    return true;
+
+  HTTPD_PROBE1(connection__close, fd);
+  close(fd);
+  return false;
+}
+
+int HttpServer::AcceptConnections(int* fds, int max) {
+  // one epoll set per waiting thread, with the listener added exclusively
+  // so that a connection wakes one waiter rather than all of them
+  static __thread int epoll_fd = -1;
+  static __thread int epoll_listener = -1;
+  static __thread unsigned epoll_generation = 0;
+  if (epoll_fd == -1 || epoll_listener != sockfd ||
+      epoll_generation != fork_generation) {
+    if (epoll_fd != -1)
+      close(epoll_fd);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+      perror("epoll_create1");
+      throw exception();
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.fd = sockfd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockfd, &event);
+    event.events = EPOLLIN;
+    event.data.fd = drain_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, drain_fd, &event);
+    epoll_listener = sockfd;
+    epoll_generation = fork_generation;
+  }
+
+  while (true) {
+    if (profiler != NULL)
+      profiler->Poll();
+    if (Draining() && !drain_listener)
+      return -1;
+
+    // the timeouts and TCP options were set on the listener, and
+    // accepted sockets inherit them
+    int count = 0;
+    while (count < max) {
+      int fd = accept4(this->sockfd, NULL, NULL, SOCK_CLOEXEC);
+      if (fd == -1)
+        break;
+      HTTPD_PROBE1(accept, fd);
+      fds[count++] = fd;
+    }
+    if (count > 0)
+      return count;
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+        errno != ECONNABORTED) {
+      perror("failed to accept a connection");
+      throw exception();
+    }
+    if (Draining())
+      return -1;
+
+    // the listener is nonblocking so that a drain isn't stuck in accept
+    epoll_event events[2];
+    epoll_wait(epoll_fd, events, 2, ACCEPT_POLL_MS);
+  }
+}
+
+void HttpServer::WaitForWorkers(const std::vector<int>& pids) {
+  // interrupt wait() when the signal comes
+  HandleUpgradeSignal(0);
+
+  size_t remaining = pids.size();
+  bool upgraded = false;
+  while (remaining > 0) {
+    if (Draining() && !upgraded) {
+      upgraded = Upgrade();
+      if (upgraded) {
+        close(sockfd);
+        for (size_t i = 0; i < pids.size(); ++i)
+          kill(pids[i], SIGUSR2);
+      }
+    }
+
+    int pid = wait(NULL);
+    if (pid == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    // the new server is a child of ours as well
+    for (size_t i = 0; i < pids.size(); ++i) {
+      if (pids[i] == pid)
+        --remaining;
+    }
   }
+}
+
+bool HttpServer::Draining() const {
+  return draining != 0;
+}
 
+bool HttpServer::Upgrade() {
+  // everything the child needs is built before the fork; it only execs
+  std::vector<char*> args;
+  for (size_t i = 0; i < command_line.size(); ++i)
+    args.push_back(const_cast<char*>(command_line[i].c_str()));
+  args.push_back(NULL);
+
+  char listen_fd[64], hot_paths_fd[64];
+  snprintf(listen_fd, sizeof(listen_fd), LISTEN_FD_ENV "=%d", sockfd);
+  snprintf(hot_paths_fd, sizeof(hot_paths_fd), HOT_PATHS_FD_ENV "=%d",
+           hot_paths->GetFd());
+  std::vector<char*> env;
+  for (char** var = environ; *var != NULL; ++var) {
+    if (strncmp(*var, LISTEN_FD_ENV "=", strlen(LISTEN_FD_ENV) + 1) != 0 &&
+        strncmp(*var, HOT_PATHS_FD_ENV "=", strlen(HOT_PATHS_FD_ENV) + 1) != 0)
+      env.push_back(*var);
+  }
+  env.push_back(listen_fd);
+  env.push_back(hot_paths_fd);
+  env.push_back(NULL);
+
+  // closed by a successful exec, or carries its errno
+  int status[2];
+  if (pipe2(status, O_CLOEXEC) == -1) {
+    perror("upgrade: pipe");
+    CancelDrain();
+    return false;
+  }
 
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("upgrade: fork");
+    close(status[0]);
+    close(status[1]);
+    CancelDrain();
+    return false;
+  }
+  if (pid == 0) {
+    close(status[0]);
+    fcntl(sockfd, F_SETFD, 0);
+    fcntl(hot_paths->GetFd(), F_SETFD, 0);
+    execve(executable.c_str(), &args[0], &env[0]);
+    int error_num = errno;
+    if (write(status[1], &error_num, sizeof(error_num)) == -1)
+      _exit(126);
+    _exit(127);
+  }
+
+  close(status[1]);
+  int error_num;
+  ssize_t numread;
+  do {
+    numread = read(status[0], &error_num, sizeof(error_num));
+  } while (numread == -1 && errno == EINTR);
+  close(status[0]);
+  if (numread > 0) {
+    errno = error_num;
+    perror("upgrade: exec");
+    waitpid(pid, NULL, 0);
+    CancelDrain();
+    return false;
+  }
+
+  fprintf(stderr, "Upgrading: new server is process %d\n", (int)pid);
+  return true;
+}
+
+void HttpServer::SetReceiveTimeout(int fd) {
   if (http_mode == "HTTP/1.1") {
     struct timeval timeout;
     timeout.tv_sec = this->timeout;
@@ -340,8 +530,59 @@ int HttpServer::AcceptConnection() {
       perror("setsockopt");
     }
   }
+}
 
-  return fd;
+void HttpServer::ConfigureListener(int fd) {
+  SetReceiveTimeout(fd);
+  // keep little unsent data queued in the kernel, so a bulk body
+  // doesn't hold what comes after it back
+  if (notsent_lowat > 0 &&
+      setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &notsent_lowat,
+                 sizeof(notsent_lowat)) == -1)
+    perror("setsockopt TCP_NOTSENT_LOWAT");
+  int on = nodelay ? 1 : 0;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1)
+    perror("setsockopt TCP_NODELAY");
+  // don't wake a worker until the client has sent its request
+  if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept,
+                 sizeof(defer_accept)) == -1)
+    perror("setsockopt TCP_DEFER_ACCEPT");
+  // the request rides on the SYN of a client holding a cookie
+  if (fastopen_queue > 0 &&
+      setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &fastopen_queue,
+                 sizeof(fastopen_queue)) == -1)
+    perror("setsockopt TCP_FASTOPEN");
+}
+
+void HttpServer::SteerToIncomingCpu(int fd) {
+  // run where the kernel processes the connection's packets, if this
+  // thread is allowed there; threads keep the CPUs they started with
+  static __thread bool have_allowed = false;
+  static __thread cpu_set_t allowed;
+  static __thread int current = -1;
+  if (!have_allowed) {
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+      return;
+    have_allowed = true;
+  }
+
+  int cpu = -1;
+  socklen_t len = sizeof(cpu);
+  getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len);
+  if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+    cpu = -1;
+  if (cpu == current)
+    return;
+
+  cpu_set_t cpus;
+  if (cpu == -1) {
+    cpus = allowed;
+  } else {
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+  }
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) == 0)
+    current = cpu;
 }
 
 int ReturnPort(const char* portnumber) {
@@ -358,7 +599,37 @@ HttpServer::HttpServer(const char* http_root, int argc, char* argv[]) {
   pthread_mutex_init(&trans_times_mutex, NULL);
 
   this->http_root = http_root;
-
+  this->reuse_port = false;
+  this->drain_listener = false;
+  this->multi_process = false;
+  // the binary is run again by path, so an upgrade picks up a new build
+  char binary[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", binary, sizeof(binary) - 1);
+  if (length > 0) {
+    binary[length] = '\0';
+    executable = binary;
+  } else {
+    executable = argv[0];
+  }
+  for (int i = 0; i < argc; ++i)
+    command_line.push_back(argv[i]);
+
+  // split --name=value options from the positional arguments
+  std::vector<char*> positional;
+  for (int i = 0; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i > 0 && arg.compare(0, 2, "--") == 0) {
+      size_t eq = arg.find('=');
+      if (eq == std::string::npos)
+        options[arg.substr(2)] = "1";
+      else
+        options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    } else {
+      positional.push_back(argv[i]);
+    }
+  }
+  argc = positional.size();
+  argv = &positional[0];
 
 
   this->http_mode = "1.0";
@@ -390,11 +661,249 @@ HttpServer::HttpServer(const char* http_root, int argc, char* argv[]) {
     throw exception();
   }
   this->timeout = timeout;
+
+
+  // admission control is off unless a target queueing delay is given
+  admission = NULL;
+  long target_ms = GetLongOption("admission-target-ms", 0);
+  if (target_ms > 0) {
+    long interval_ms = GetLongOption("admission-interval-ms", 100);
+    admission = new AdmissionControl(target_ms * 1000, interval_ms * 1000);
+  }
+
+  rate_limiter = NULL;
+  long rate = GetLongOption("client-rate", 0);
+  if (rate > 0) {
+    long burst = GetLongOption("client-burst", rate);
+    rate_limiter = new ClientRateLimiter(rate, burst);
+  }
+
+  proxy = NULL;
+  std::string routes = GetOption("proxy", "");
+  if (!routes.empty()) {
+    proxy = new ReverseProxy(routes, this->timeout,
+                             GetLongOption("proxy-cache-ms", 0),
+                             GetLongOption("proxy-cache-max-bytes", 65536));
+  }
+
+  // request counts carried over from the server we replace, if any
+  // or else the ones saved in the manifest before a restart
+  hot_paths = new HotPaths;
+  manifest = GetOption("hot-manifest", "");
+  manifest_interval = GetLongOption("hot-manifest-interval-s", 60);
+  int inherited = InheritedFd(HOT_PATHS_FD_ENV);
+  if (inherited != -1) {
+    try {
+      HotPaths previous(inherited);
+      hot_paths->Import(previous);
+    } catch (exception&) {
+    }
+  } else if (!manifest.empty()) {
+    hot_paths->Load(manifest);
+  }
+  preloader = new Preloader(this->http_root,
+                            GetLongOption("preload-threads", 4),
+                            GetLongOption("preload-mlock-bytes", 0));
+
+  // small files kept in memory shared by all workers; made before the
+  // workers are forked
+  content_cache = NULL;
+  long long cache_bytes = GetLongOption("content-cache-bytes", 0);
+  if (cache_bytes > 0) {
+    content_cache = new ContentCache(
+        cache_bytes, GetLongOption("content-cache-revalidate-ms", 1000));
+  }
+
+  router = new Router;
+  router->Handle("/*", new StaticFileHandler(this->http_root, hot_paths,
+                                             content_cache));
+  std::string status_path = GetOption("status-path", "");
+  if (!status_path.empty())
+    router->Handle(status_path, new StatusHandler(this));
+
+  // the sampling profiler is off unless given a rate; 99 Hz is cheap
+  profiler = NULL;
+  long profile_hz = GetLongOption("profile-hz", 0);
+  if (profile_hz > 0) {
+    profiler = new Profiler(profile_hz,
+                            GetLongOption("profile-max-samples", 65536),
+                            GetLongOption("profile-seconds", 10),
+                            GetOption("profile-output", "myhttpd-profile"));
+    std::string profile_path = GetOption("profile-path", "");
+    if (!profile_path.empty())
+      router->Handle(profile_path, new ProfileHandler(profiler, this));
+  }
+
+  // uploads are refused with 501 unless a size limit is set
+  uploads = NULL;
+  long long max_upload = GetLongOption("upload-max-bytes", 0);
+  if (max_upload > 0)
+    uploads = new UploadHandler(max_upload);
+
+  // TLS termination; kernel TLS is used when the kernel and OpenSSL allow,
+  // which with OpenSSL 3.0 takes --tls-max-version=1.2
+  tls = NULL;
+  std::string cert = GetOption("tls-cert", "");
+  if (!cert.empty())
+    tls = new TlsContext(cert, GetOption("tls-key", cert),
+                         GetOption("tls-max-version", ""));
+
+  // response bodies go out a send quantum at a time; rates are bytes per
+  // second and uncapped unless given
+  bandwidth = new BandwidthLimiter(GetLongOption("send-rate", 0),
+                                   GetLongOption("connection-send-rate", 0),
+                                   GetLongOption("send-quantum", 65536));
+  notsent_lowat = GetLongOption("notsent-lowat", 131072);
+
+  // connection setup: seconds to hold a connection until its first bytes
+  // arrive, the pending Fast Open SYN queue, and steering of connection
+  // threads to the CPU their packets arrive on
+  defer_accept = GetLongOption("defer-accept-s", 1);
+  fastopen_queue = GetLongOption("fastopen-queue", 256);
+  nodelay = GetLongOption("tcp-nodelay", 1) != 0;
+  incoming_cpu = GetLongOption("incoming-cpu", 0) != 0;
+
+  // cleartext HTTP/2, by prior knowledge or Upgrade: h2c.  Off by default:
+  // streams are served straight from http_root, without the proxy,
+  // uploads, registered handlers or the content cache, so it is refused
+  // alongside any of those that would be bypassed
+  h2c = GetLongOption("h2c", 0) != 0;
+  if (h2c && (proxy != NULL || uploads != NULL || !status_path.empty() ||
+              (profiler != NULL && !GetOption("profile-path", "").empty()))) {
+    fprintf(stderr, "--h2c can't be combined with --proxy, "
+            "--upload-max-bytes, --status-path or --profile-path\n");
+    throw exception();
+  }
+
+  overloaded_response = this->http_mode + " 503 Service Unavailable\r\n"
+      "Retry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  rate_limited_response = this->http_mode + " 429 Too Many Requests\r\n"
+      "Retry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  if (tls != NULL) {
+    // rejected before the handshake, so there is no way to answer
+    overloaded_response.clear();
+    rate_limited_response.clear();
+  }
+}
+
+std::string HttpServer::GetOption(const std::string& name,
+                                  const std::string& default_value) const {
+  std::map<std::string, std::string>::const_iterator it = options.find(name);
+  if (it == options.end())
+    return default_value;
+  return it->second;
+}
+
+long HttpServer::GetLongOption(const std::string& name,
+                               long default_value) const {
+  std::map<std::string, std::string>::const_iterator it = options.find(name);
+  if (it == options.end())
+    return default_value;
+
+  long value;
+  if (sscanf(it->second.c_str(), "%ld", &value) != 1) {
+    fprintf(stderr, "Invalid value for --%s: %s\n", name.c_str(),
+            it->second.c_str());
+    throw exception();
+  }
+  return value;
+}
+
+void HttpServer::Handle(const std::string& pattern, HttpHandler* handler) {
+  router->Handle(pattern, handler);
+}
+
+void HttpServer::CompileRoutes() {
+  router->Compile();
 }
 
 void HttpServer::Start() {
+  CompileRoutes();
+
+  // before listening, so a fresh server isn't sent traffic while cold
+  WarmPageCache();
+
+  int inherited = InheritedFd(LISTEN_FD_ENV);
+  int accepting = 0;
+  socklen_t len = sizeof(accepting);
+  if (inherited != -1 &&
+      (getsockopt(inherited, SOL_SOCKET, SO_ACCEPTCONN, &accepting,
+                  &len) == -1 || !accepting)) {
+    fprintf(stderr, "Inherited descriptor %d is not a listener\n", inherited);
+    inherited = -1;
+  }
+  if (inherited != -1) {
+    this->sockfd = inherited;
+    fcntl(sockfd, F_SETFD, FD_CLOEXEC);
+    // this binary's options replace the ones it was listening with
+    ConfigureListener(sockfd);
+  } else {
+    this->sockfd = Listen();
+  }
+  fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+
+  // with SA_RESTART connection I/O carries on; waiting threads wake on
+  // drain_fd
+  if (drain_fd == -1) {
+    drain_fd = CreateDrainFd();
+    pthread_atfork(NULL, NULL, OnFork);
+  }
+  HandleUpgradeSignal(SA_RESTART);
+
+  if (!manifest.empty() && manifest_interval > 0) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, RunManifestWriter, this) != 0) {
+      perror("pthread_create");
+      throw exception();
+    }
+    pthread_detach(thread);
+  }
+}
+
+void HttpServer::WarmPageCache() {
+  std::vector<std::pair<std::string, uint32_t> > counts;
+  hot_paths->Snapshot(GetLongOption("preload-paths", 256), &counts);
+  if (counts.empty())
+    return;
+
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < counts.size(); ++i)
+    paths.push_back(counts[i].first);
+  preloader->Run(paths);
+  fprintf(stderr, "Preloaded %d files, %lld bytes (%lld locked) in %ld ms\n",
+          preloader->Files(), preloader->BytesRead(),
+          preloader->BytesLocked(), preloader->Micros() / 1000);
+}
+
+void* HttpServer::RunManifestWriter(void* arg) {
+  ((HttpServer*)arg)->WriteManifest();
+  return NULL;
+}
 
-  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+void HttpServer::WriteManifest() {
+  // a second at a time, so a draining server saves once more and lets the
+  // process exit
+  long elapsed = 0;
+  while (!Draining()) {
+    sleep(1);
+    if (++elapsed >= manifest_interval) {
+      hot_paths->Save(manifest, MANIFEST_PATHS);
+      elapsed = 0;
+    }
+  }
+  hot_paths->Save(manifest, MANIFEST_PATHS);
+}
+
+const Preloader* HttpServer::GetPreloader() const {
+  return preloader;
+}
+
+const ContentCache* HttpServer::GetContentCache() const {
+  return content_cache;
+}
+
+int HttpServer::Listen() {
+  int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
   if (sockfd == -1) {
     perror("creating socket failed");
     throw exception();
@@ -403,6 +912,11 @@ void HttpServer::Start() {
 
   int on = 1;
   setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+  if (reuse_port &&
+      setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+    perror("setsockopt SO_REUSEPORT");
+    throw exception();
+  }
 
 
   sockaddr_in my_address;
@@ -417,12 +931,13 @@ void HttpServer::Start() {
   }
 
 
+  ConfigureListener(sockfd);
   if (listen(sockfd, GetBacklog()) == -1) {
     perror("failed to listen");
     throw exception();
   }
 
-  this->sockfd = sockfd;
+  return sockfd;
 }
 
 void HttpServer::Stop() {
@@ -22,10 +22,27 @@
 #ifndef MYHTTPD_HPP_
 #define MYHTTPD_HPP_
 
+#include <sys/time.h>
+
+#include <map>
 #include <string>
+#include <vector>
 
 #define DEFAULT_HTTP_ROOT "myhttpd-root"
 
+class AdmissionControl;
+class BandwidthLimiter;
+class ContentCache;
+class ClientRateLimiter;
+class HotPaths;
+class HttpHandler;
+class Preloader;
+class Profiler;
+class ReverseProxy;
+class Router;
+class TlsContext;
+class UploadHandler;
+
 class HttpServer {
  public:
   std::string http_mode;
@@ -33,14 +50,91 @@ class HttpServer {
   int timeout;
   std::string http_root;
   int sockfd;
+  // listen with SO_REUSEPORT so that workers can open their own listeners
+  bool reuse_port;
+  // keep accepting what is queued once draining; for listeners that are
+  // closed rather than handed to the new server
+  bool drain_listener;
+  // requests are served by several worker processes
+  bool multi_process;
+  // --name=value arguments, accepted anywhere on the command line
+  std::map<std::string, std::string> options;
 
   HttpServer(const char* http_root, int argc, char* argv[]);
+  std::string GetOption(const std::string& name,
+                        const std::string& default_value) const;
+  long GetLongOption(const std::string& name, long default_value) const;
+  // Routes |pattern| (see Router) to |handler|; call before Start().  Files
+  // under http_root are served by a handler registered for "/*".
+  void Handle(const std::string& pattern, HttpHandler* handler);
+  // Rebuilds the routing tables in memory allocated under the calling
+  // process's current NUMA policy.
+  void CompileRoutes();
   void Start();
+  int Listen();
   virtual void Serve() = 0;
   virtual int GetBacklog() = 0;
   void Stop();
+  // Returns -1 once the server is draining.
   int AcceptConnection();
+  // Accepts up to |max| queued connections into |fds| per wakeup and
+  // returns how many, or -1 once the server is draining.  For a caller
+  // that hands connections on rather than serving them itself.
+  int AcceptConnections(int* fds, int max);
+  // SIGUSR2 asks the server to re-execute its binary, passing on the
+  // listener, and to finish the connections it has without taking more.
+  bool Draining() const;
+  // Starts the new binary on this server's listener.  On failure the
+  // drain is called off.
+  bool Upgrade();
+  // Waits for the worker processes, upgrading and then draining them on
+  // SIGUSR2.
+  void WaitForWorkers(const std::vector<int>& pids);
+  bool Admit(int fd, const timeval& accepted);
+  // Turns |fd| away with 503, as Admit() does when overloaded.
+  void Shed(int fd);
   void ProcessRequest(int fd);
+  // What WarmPageCache() did at startup.
+  const Preloader* GetPreloader() const;
+  // NULL unless --content-cache-bytes is set.
+  const ContentCache* GetContentCache() const;
+
+ private:
+  AdmissionControl* admission;
+  ClientRateLimiter* rate_limiter;
+  ReverseProxy* proxy;
+  HotPaths* hot_paths;
+  ContentCache* content_cache;
+  Preloader* preloader;
+  Profiler* profiler;
+  // the hot paths are saved here periodically and loaded at startup
+  std::string manifest;
+  long manifest_interval;
+  Router* router;
+  TlsContext* tls;
+  UploadHandler* uploads;
+  BandwidthLimiter* bandwidth;
+  int notsent_lowat;
+  int defer_accept;
+  int fastopen_queue;
+  bool nodelay;
+  bool incoming_cpu;
+  bool h2c;
+  std::string overloaded_response;
+  std::string rate_limited_response;
+  std::string executable;
+  std::vector<std::string> command_line;
+
+  void ServeConnection(int fd);
+  void SetReceiveTimeout(int fd);
+  // Waits for the next request on a keep-alive connection, closing it on
+  // a drain or after the idle timeout.
+  bool AwaitRequest(int fd);
+  void ConfigureListener(int fd);
+  void SteerToIncomingCpu(int fd);
+  void WarmPageCache();
+  static void* RunManifestWriter(void* arg);
+  void WriteManifest();
 };
 
 
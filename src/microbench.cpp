@@ -0,0 +1,320 @@
+/*
+ * microbench.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "http_request.hpp"
+#include "router.hpp"
+
+#define DEFAULT_ITERATIONS 10000
+#define DEFAULT_REPETITIONS 5
+
+namespace {
+
+// operator new calls; malloc from C code such as fopen is not counted
+size_t allocations = 0;
+
+}
+
+void* operator new(size_t size) {
+  ++allocations;
+  void* p = malloc(size);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) throw() {
+  free(p);
+}
+
+// out of line, or GCC pairs the inlined free() with new and warns
+__attribute__((noinline)) void operator delete(void* p, size_t) throw() {
+  operator delete(p);
+}
+
+namespace {
+
+volatile size_t sink;
+
+long long Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// CPU cycles via perf_event_open; disabled when the kernel refuses.
+class CycleCounter {
+ public:
+  CycleCounter() : fd(-1) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd == -1) {
+      // unprivileged users may only count user space
+      attr.exclude_kernel = 1;
+      fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+  }
+
+  ~CycleCounter() {
+    if (fd != -1)
+      close(fd);
+  }
+
+  bool Available() const {
+    return fd != -1;
+  }
+
+  void Start() {
+    if (fd == -1)
+      return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  long long Stop() {
+    if (fd == -1)
+      return 0;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    long long count = 0;
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+      return 0;
+    return count;
+  }
+
+ private:
+  int fd;
+};
+
+struct Fixture {
+  int socket_pair[2];
+  int dev_null;
+  std::string pending;
+  std::string http_root;
+  std::string request;
+  std::string uri;
+  Router* router;
+};
+
+typedef void (*BenchFunction)(Fixture* fixture);
+
+void BenchReadRequest(Fixture* f) {
+  Write(f->socket_pair[0], f->request);
+  HttpRequest req;
+  req.Read(f->socket_pair[1], &f->pending);
+  sink += req.uri.length();
+}
+
+void BenchPathFromUri(Fixture* f) {
+  std::string path = PathFromUri(f->uri);
+  path = f->http_root + ReplaceString(path, std::string("%20"), " ");
+  sink += path.length();
+}
+
+void BenchFindHeaderEnd(Fixture* f) {
+  sink += FindHeaderEnd(f->request, 0);
+}
+
+void BenchSerializeHeaders(Fixture* f) {
+  char content_length_str[32];
+  Write(f->dev_null, std::string("HTTP/1.1") + " 200 OK\r\n");
+  sprintf(content_length_str, "Content-Length: %ld\r\n", 4096L);
+  Write(f->dev_null, content_length_str);
+  EndHeaders(f->dev_null, "HTTP/1.0", "HTTP/1.1");
+}
+
+void BenchRespond(Fixture* f) {
+  HttpRequest req;
+  req.method = "GET";
+  req.uri = "/file%204k.bin";
+  req.http_mode = "HTTP/1.1";
+  req.bad = false;
+  f->router->Dispatch(&req, f->dev_null, "HTTP/1.1", true);
+}
+
+void BenchRespondNotFound(Fixture* f) {
+  HttpRequest req;
+  req.method = "GET";
+  req.uri = "/missing.html";
+  req.http_mode = "HTTP/1.1";
+  req.bad = false;
+  f->router->Dispatch(&req, f->dev_null, "HTTP/1.1", true);
+}
+
+struct Benchmark {
+  const char* name;
+  BenchFunction function;
+};
+
+const Benchmark benchmarks[] = {
+  { "read_request", BenchReadRequest },
+  { "path_from_uri", BenchPathFromUri },
+  { "find_header_end", BenchFindHeaderEnd },
+  { "serialize_headers", BenchSerializeHeaders },
+  { "respond_4k", BenchRespond },
+  { "respond_404", BenchRespondNotFound },
+};
+
+struct Sample {
+  double ns;
+  double allocations;
+  double cycles;
+
+  bool operator<(const Sample& other) const {
+    return ns < other.ns;
+  }
+};
+
+void Run(const Benchmark& benchmark, Fixture* fixture, CycleCounter* cycles,
+         long iterations, int repetitions) {
+  // warm caches, the page cache and the allocator before measuring
+  for (long i = 0; i < iterations / 10 + 1; ++i)
+    benchmark.function(fixture);
+
+  std::vector<Sample> samples;
+  for (int r = 0; r < repetitions; ++r) {
+    size_t allocations_start = allocations;
+    long long start = Now();
+    cycles->Start();
+    for (long i = 0; i < iterations; ++i)
+      benchmark.function(fixture);
+    long long cycle_count = cycles->Stop();
+    long long end = Now();
+
+    Sample sample;
+    sample.ns = (double)(end - start) / iterations;
+    sample.allocations = (double)(allocations - allocations_start) /
+        iterations;
+    sample.cycles = (double)cycle_count / iterations;
+    samples.push_back(sample);
+  }
+
+  std::sort(samples.begin(), samples.end());
+  const Sample& best = samples.front();
+  const Sample& median = samples[samples.size() / 2];
+  printf("%-20s %12.1f %12.1f %12.1f ", benchmark.name, best.ns, median.ns,
+         best.allocations);
+  if (cycles->Available())
+    printf("%12.1f\n", best.cycles);
+  else
+    printf("%12s\n", "n/a");
+}
+
+std::string MakeHttpRoot() {
+  const char* dirs[] = { "/dev/shm", "/tmp" };
+  for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); ++i) {
+    std::string root = std::string(dirs[i]) + "/microbench.XXXXXX";
+    std::vector<char> buf(root.begin(), root.end());
+    buf.push_back('\0');
+    if (mkdtemp(&buf[0]) != NULL)
+      return std::string(&buf[0]);
+  }
+  perror("mkdtemp");
+  throw std::exception();
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  long iterations = DEFAULT_ITERATIONS;
+  int repetitions = DEFAULT_REPETITIONS;
+  if (argc > 1)
+    sscanf(argv[1], "%ld", &iterations);
+  if (argc > 2)
+    sscanf(argv[2], "%d", &repetitions);
+  const char* filter = argc > 3 ? argv[3] : NULL;
+  if (iterations <= 0 || repetitions <= 0) {
+    fprintf(stderr, "Usage: %s [<iterations> [<repetitions> [<filter>]]]\n",
+            argv[0]);
+    return 1;
+  }
+
+  Fixture fixture;
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fixture.socket_pair) == -1) {
+    perror("socketpair");
+    return 1;
+  }
+  fixture.dev_null = open("/dev/null", O_WRONLY);
+  if (fixture.dev_null == -1) {
+    perror("open");
+    return 1;
+  }
+  fixture.request =
+      "GET /some%20dir/index.html HTTP/1.1\r\n"
+      "Host: localhost:8080\r\n"
+      "User-Agent: microbench\r\n"
+      "Accept: */*\r\n"
+      "\r\n";
+  fixture.uri = "http://localhost:8080/some%20dir/index.html";
+  fixture.http_root = MakeHttpRoot();
+  fixture.router = new Router;
+  fixture.router->Handle("/*", new StaticFileHandler(fixture.http_root, NULL));
+  fixture.router->Compile();
+
+  std::string file_path = fixture.http_root + "/file 4k.bin";
+  FILE* file = fopen(file_path.c_str(), "w");
+  if (file == NULL) {
+    perror("fopen");
+    return 1;
+  }
+  std::string contents(4096, 'x');
+  fwrite(contents.data(), 1, contents.length(), file);
+  fclose(file);
+
+  CycleCounter cycles;
+  printf("%-20s %12s %12s %12s %12s\n", "benchmark", "ns/op", "median",
+         "allocs/op", "cycles/op");
+  for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i) {
+    if (filter != NULL && strstr(benchmarks[i].name, filter) == NULL)
+      continue;
+    Run(benchmarks[i], &fixture, &cycles, iterations, repetitions);
+  }
+
+  unlink(file_path.c_str());
+  rmdir(fixture.http_root.c_str());
+  close(fixture.dev_null);
+  close(fixture.socket_pair[0]);
+  close(fixture.socket_pair[1]);
+  return 0;
+}
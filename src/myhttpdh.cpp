@@ -0,0 +1,168 @@
+/*
+ * myhttpdh.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <exception>
+#include <vector>
+
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "http_server.hpp"
+#include "topology.hpp"
+
+#define HYBRID_BACKLOG 1000
+#define DEFAULT_THREADS_PER_CPU 16
+
+using namespace std;
+
+void* ServeConnections(void* arg);
+
+// One process per NUMA node, each pinned to its node's CPUs and memory,
+// with its own SO_REUSEPORT listener and a fixed pool of threads that
+// accept and serve connections.  The kernel spreads connections over the
+// listeners.  What a worker allocates after binding (thread stacks,
+// buffers, the routing tables it compiles again) and the private pages
+// it writes, which are copied on write, are node-local.  Anything the
+// parent built and the worker only reads, such as handler objects, stays
+// on the parent's node.  So do the segments shared between the workers
+// on purpose: the content cache, hot path table and rate caps.
+class HybridHttpServer : public HttpServer {
+ public:
+  HybridHttpServer(const char* http_root, int argc, char* argv[])
+    : HttpServer(http_root, argc, argv) {
+    reuse_port = true;
+    multi_process = GetLongOption("processes", ReadNumaTopology().size()) > 1;
+  }
+
+  void Serve() {
+    std::vector<NumaNode> nodes = ReadNumaTopology();
+    int numprocesses = GetLongOption("processes", nodes.size());
+    bool bind_numa = GetLongOption("numa", 1) != 0;
+    if (numprocesses <= 0) {
+      fprintf(stderr, "Invalid --processes: %d\n", numprocesses);
+      throw exception();
+    }
+
+    std::vector<int> pids;
+    for (int i = 0; i < numprocesses; ++i) {
+      int pid = fork();
+      if (pid == -1) {
+        perror("fork");
+        throw exception();
+      } else if (pid == 0) {
+        ServeNode(i, nodes[i % nodes.size()], bind_numa);
+        exit(0);
+      }
+      pids.push_back(pid);
+    }
+
+    // Start()'s listener stays open here only to be handed on by an
+    // upgrade; the first worker accepts on it
+    WaitForWorkers(pids);
+  }
+
+  int GetBacklog() {
+    return HYBRID_BACKLOG;
+  }
+
+ private:
+  void ServeNode(int index, const NumaNode& node, bool bind_numa) {
+    signal(SIGPIPE, SIG_IGN);
+
+    // bind before anything else is allocated, so the listener, thread
+    // stacks and buffers all come from the node's memory
+    if (bind_numa) {
+      BindToNumaNode(node);
+      CompileRoutes();
+    }
+    if (index > 0) {
+      // closed when we exit, so whatever is queued on it must be taken
+      close(sockfd);
+      sockfd = Listen();
+      fcntl(sockfd, F_SETFL, O_NONBLOCK);
+      drain_listener = true;
+    }
+
+    int numthreads = GetLongOption("threads",
+                                   node.num_cpus * DEFAULT_THREADS_PER_CPU);
+    if (numthreads <= 0) {
+      fprintf(stderr, "Invalid --threads: %d\n", numthreads);
+      exit(1);
+    }
+
+    std::vector<pthread_t> threads(numthreads);
+    for (int i = 0; i < numthreads; ++i) {
+      if (pthread_create(&threads[i], NULL, ::ServeConnections, this) != 0) {
+        perror("pthread_create");
+        exit(1);
+      }
+    }
+    for (int i = 0; i < numthreads; ++i)
+      pthread_join(threads[i], NULL);
+  }
+};
+
+void* ServeConnections(void* arg) {
+  HybridHttpServer* server = (HybridHttpServer*)arg;
+
+  while (true) {
+    int fd;
+    try {
+      fd = server->AcceptConnection();
+    } catch (exception&) {
+      // e.g. out of descriptors; back off instead of losing the thread
+      usleep(10000);
+      continue;
+    }
+    if (fd == -1)
+      break;
+
+    timeval accepted;
+    gettimeofday(&accepted, NULL);
+    if (!server->Admit(fd, accepted))
+      continue;
+
+    try {
+      server->ProcessRequest(fd);
+    } catch (int error_num) {
+      if (error_num != EPIPE && error_num != ECONNRESET) {
+        perror("read/write");
+        exit(1);
+      }
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char* argv[]) {
+  HybridHttpServer server(DEFAULT_HTTP_ROOT, argc, argv);
+  server.Start();
+  server.Serve();
+  return 0;
+}
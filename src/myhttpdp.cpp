@@ -24,7 +24,9 @@
 #include <cstdio>
 
 #include <exception>
+#include <vector>
 
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -38,10 +40,12 @@ class MultiProcessHttpServer : public HttpServer {
  public:
   MultiProcessHttpServer(const char* http_root, int argc, char* argv[])
     : HttpServer(http_root, argc, argv) {
+    multi_process = true;
   }
 
   void Serve() {
     int numprocesses = 5;
+    std::vector<int> pids;
     for (int i = 0; i < numprocesses; ++i) {
       int pid = fork();
       if (pid == -1) {
@@ -52,6 +56,13 @@ class MultiProcessHttpServer : public HttpServer {
 
         while (true) {
           int fd = AcceptConnection();
+          if (fd == -1)
+            break;
+          timeval accepted;
+          gettimeofday(&accepted, NULL);
+          if (!Admit(fd, accepted))
+            continue;
+
           try {
             ProcessRequest(fd);
           } catch (int error_num) {
@@ -61,11 +72,12 @@ class MultiProcessHttpServer : public HttpServer {
             throw error_num;
           }
         }
+        exit(0);
       }
+      pids.push_back(pid);
     }
 
-    for (int i = 0; i < numprocesses; ++i)
-      wait(NULL);
+    WaitForWorkers(pids);
   }
 
   int GetBacklog() {
@@ -24,35 +24,83 @@
 #include <cstdlib>
 #include <cerrno>
 #include <pthread.h>
+#include <sys/time.h>
 
 #include <exception>
-#include <utility>
+#include <vector>
 
 #include "http_server.hpp"
 
 #define MULTI_THREADED_BACKLOG 1000
+#define DEFAULT_MAX_THREADS 1024
 
 using namespace std;
 
 void* ProcessRequest(void* arg);
 
+class MultiThreadedHttpServer;
+
+struct Connection {
+  MultiThreadedHttpServer* server;
+  int fd;
+};
+
 class MultiThreadedHttpServer : public HttpServer {
  public:
-  MultiThreadedHttpServer(const char* http_root, int argc, char* argv[]): HttpServer(http_root, argc, argv) {}
+  // connection threads alive, decremented by each as it finishes
+  volatile int live_threads;
+
+  MultiThreadedHttpServer(const char* http_root, int argc, char* argv[]): HttpServer(http_root, argc, argv), live_threads(0) {}
 
   void Serve() {
     signal(SIGPIPE, SIG_IGN);
 
+    int accept_batch = GetLongOption("accept-batch", 16);
+    if (accept_batch <= 0) {
+      fprintf(stderr, "Invalid --accept-batch: %d\n", accept_batch);
+      throw exception();
+    }
+    int max_threads = GetLongOption("max-threads", DEFAULT_MAX_THREADS);
+    std::vector<int> fds(accept_batch);
     while (true) {
-      int fd = AcceptConnection();
-      pthread_t thread;
-      pair<MultiThreadedHttpServer*, int>* arg_pair =
-          new pair<MultiThreadedHttpServer*, int>(this, fd);
-      if (pthread_create(&thread, NULL, ::ProcessRequest, arg_pair) != 0) {
-        perror("pthread_create");
-        throw exception();
+      int count = AcceptConnections(&fds[0], accept_batch);
+      if (count == -1) {
+        if (Upgrade())
+          break;
+        continue;
+      }
+      // admitted here, so a shed connection never costs a thread
+      timeval accepted;
+      gettimeofday(&accepted, NULL);
+      for (int i = 0; i < count; ++i) {
+        if (!Admit(fds[i], accepted))
+          continue;
+        if (max_threads > 0 && live_threads >= max_threads) {
+          Shed(fds[i]);
+          continue;
+        }
+
+        pthread_t thread;
+        Connection* connection = new Connection;
+        connection->server = this;
+        connection->fd = fds[i];
+        __sync_fetch_and_add(&live_threads, 1);
+        int error_num = pthread_create(&thread, NULL, ::ProcessRequest,
+                                       connection);
+        if (error_num != 0) {
+          // out of threads or memory for stacks; overloaded all the same
+          __sync_fetch_and_sub(&live_threads, 1);
+          delete connection;
+          Shed(fds[i]);
+          continue;
+        }
+        pthread_detach(thread);
       }
     }
+
+    // the process exits once the last connection thread is done
+    close(sockfd);
+    pthread_exit(NULL);
   }
 
   int GetBacklog() {
@@ -61,11 +109,10 @@ class MultiThreadedHttpServer : public HttpServer {
 };
 
 void* ProcessRequest(void* arg) {
-  pair<MultiThreadedHttpServer*, int>* arg_pair;
-  arg_pair = (pair<MultiThreadedHttpServer*, int>*)arg;
+  Connection* connection = (Connection*)arg;
 
   try {
-    (arg_pair->first)->ProcessRequest(arg_pair->second);
+    connection->server->ProcessRequest(connection->fd);
   } catch (int error_num) {
 
     if (error_num != EPIPE && error_num != ECONNRESET) {
@@ -74,13 +121,17 @@ void* ProcessRequest(void* arg) {
     }
   }
 
-  delete arg_pair;
+  __sync_fetch_and_sub(&connection->server->live_threads, 1);
+  delete connection;
   return NULL;
 }
 
 int main(int argc, char* argv[]) {
-  MultiThreadedHttpServer server(DEFAULT_HTTP_ROOT, argc, argv);
-  server.Start();
-  server.Serve();
+  // not on the stack: after an upgrade the main thread exits, unwinding
+  // it, while connection threads are still using the server
+  MultiThreadedHttpServer* server =
+      new MultiThreadedHttpServer(DEFAULT_HTTP_ROOT, argc, argv);
+  server->Start();
+  server->Serve();
   return 0;
 }
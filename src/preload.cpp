@@ -0,0 +1,167 @@
+/*
+ * preload.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "http_request.hpp"
+#include "preload.hpp"
+
+#define PRELOAD_MAX_THREADS 64
+
+Preloader::Preloader(const std::string& http_root, int threads,
+                     long long lock_budget)
+    : http_root(http_root),
+      threads(std::max(1, std::min(threads, PRELOAD_MAX_THREADS))),
+      lock_budget(lock_budget), paths(NULL), next(0), micros(0), files(0),
+      bytes_read(0), bytes_locked(0) {
+  pthread_mutex_init(&mutex, NULL);
+}
+
+Preloader::~Preloader() {
+  for (size_t i = 0; i < locked.size(); ++i)
+    munmap(locked[i].address, locked[i].length);
+  pthread_mutex_destroy(&mutex);
+}
+
+void Preloader::Run(const std::vector<std::string>& paths) {
+  timeval start, end;
+  gettimeofday(&start, NULL);
+
+  this->paths = &paths;
+  next = 0;
+  sizes.assign(paths.size(), -1);
+
+  std::vector<pthread_t> workers;
+  for (int i = 1; i < threads && (size_t)i < paths.size(); ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, RunWorker, this) != 0) {
+      perror("pthread_create");
+      break;
+    }
+    workers.push_back(thread);
+  }
+  Work();
+  for (size_t i = 0; i < workers.size(); ++i)
+    pthread_join(workers[i], NULL);
+
+  if (lock_budget > 0)
+    Lock();
+  this->paths = NULL;
+
+  gettimeofday(&end, NULL);
+  micros = (end.tv_sec - start.tv_sec) * 1000000L +
+      end.tv_usec - start.tv_usec;
+}
+
+void* Preloader::RunWorker(void* arg) {
+  ((Preloader*)arg)->Work();
+  return NULL;
+}
+
+void Preloader::Work() {
+  while (true) {
+    pthread_mutex_lock(&mutex);
+    size_t i = next++;
+    pthread_mutex_unlock(&mutex);
+    if (i >= paths->size())
+      return;
+
+    int file;
+    off_t size;
+    try {
+      if (OpenFile(http_root, (*paths)[i], &file, &size) != 200)
+        continue;
+    } catch (int) {
+      continue;
+    }
+    // readahead waits for the reads to be queued, which keeps each thread
+    // to one file in flight; fadvise covers filesystems without it
+    if (readahead(file, 0, size) == -1)
+      posix_fadvise(file, 0, size, POSIX_FADV_WILLNEED);
+    close(file);
+
+    pthread_mutex_lock(&mutex);
+    sizes[i] = size;
+    ++files;
+    bytes_read += size;
+    pthread_mutex_unlock(&mutex);
+  }
+}
+
+void Preloader::Lock() {
+  // hottest first; a file that doesn't fit is skipped for smaller ones
+  for (size_t i = 0; i < paths->size(); ++i) {
+    off_t size = sizes[i];
+    if (size <= 0 || bytes_locked + size > lock_budget)
+      continue;
+
+    int file;
+    try {
+      if (OpenFile(http_root, (*paths)[i], &file, &size) != 200)
+        continue;
+    } catch (int) {
+      continue;
+    }
+    if (size <= 0 || bytes_locked + size > lock_budget) {
+      close(file);
+      continue;
+    }
+    void* address = mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if (address == MAP_FAILED)
+      continue;
+    if (mlock(address, size) == -1) {
+      // RLIMIT_MEMLOCK, most likely; nothing after this will fit either
+      perror("mlock");
+      munmap(address, size);
+      return;
+    }
+    Mapping mapping = { address, (size_t)size };
+    locked.push_back(mapping);
+    bytes_locked += size;
+  }
+}
+
+long Preloader::Micros() const {
+  return micros;
+}
+
+int Preloader::Files() const {
+  return files;
+}
+
+long long Preloader::BytesRead() const {
+  return bytes_read;
+}
+
+long long Preloader::BytesLocked() const {
+  return bytes_locked;
+}
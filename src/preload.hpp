@@ -0,0 +1,72 @@
+/*
+ * preload.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PRELOAD_HPP_
+#define PRELOAD_HPP_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+// Pulls the files behind a list of paths, hottest first, into the page
+// cache before the server takes traffic.  Several threads issue
+// readahead at once so the device sees a deep queue; the first
+// |lock_budget| bytes worth of whole files are also mapped and mlocked so
+// they stay resident under memory pressure.
+class Preloader {
+ public:
+  Preloader(const std::string& http_root, int threads, long long lock_budget);
+  ~Preloader();
+
+  void Run(const std::vector<std::string>& paths);
+
+  long Micros() const;
+  int Files() const;
+  long long BytesRead() const;
+  long long BytesLocked() const;
+
+ private:
+  struct Mapping {
+    void* address;
+    size_t length;
+  };
+
+  std::string http_root;
+  int threads;
+  long long lock_budget;
+  const std::vector<std::string>* paths;
+  size_t next;
+  pthread_mutex_t mutex;
+  std::vector<off_t> sizes;
+  std::vector<Mapping> locked;
+  long micros;
+  int files;
+  long long bytes_read;
+  long long bytes_locked;
+
+  static void* RunWorker(void* arg);
+  void Work();
+  void Lock();
+};
+
+#endif
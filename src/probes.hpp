@@ -0,0 +1,62 @@
+/*
+ * probes.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROBES_HPP_
+#define PROBES_HPP_
+
+/*
+ * Static tracepoints on the request lifecycle, provider "myhttpd".  With
+ * <sys/sdt.h> available each probe is a single nop until a tracer
+ * attaches; without it they compile to nothing.
+ *
+ *   accept(fd)                        connection accepted
+ *   first__byte(fd)                   first byte of a request available
+ *   request__parsed(fd, method, uri)  request line parsed
+ *   file__resolved(fd, path, hit)     file opened, hit = 1 if cached
+ *   headers__sent(fd)                 response headers written
+ *   body__complete(fd, bytes)         response body written
+ *   connection__close(fd)             connection closed by the server
+ *
+ * The names are used as written: without a dtrace -h generated provider
+ * the double underscores are not turned into dashes.
+ *
+ * e.g. bpftrace -e 'usdt:./myhttpdt:myhttpd:accept { @[tid] = nsecs; }
+ *                   usdt:./myhttpdt:myhttpd:headers__sent /@[tid]/ {
+ *                     @us = hist((nsecs - @[tid]) / 1000); }'
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define HTTPD_PROBE1(name, a) DTRACE_PROBE1(myhttpd, name, a)
+#define HTTPD_PROBE2(name, a, b) DTRACE_PROBE2(myhttpd, name, a, b)
+#define HTTPD_PROBE3(name, a, b, c) DTRACE_PROBE3(myhttpd, name, a, b, c)
+#else
+#define HTTPD_PROBE1(name, a) do {} while (0)
+#define HTTPD_PROBE2(name, a, b) do {} while (0)
+#define HTTPD_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif
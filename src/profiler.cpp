@@ -0,0 +1,408 @@
+/*
+ * profiler.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "http_request.hpp"
+#include "http_server.hpp"
+#include "profiler.hpp"
+#include "router.hpp"
+
+#define PROFILER_MAX_DEPTH 64
+#define PROFILER_CHUNK_SAMPLES 32
+// frames further than this above the interrupted stack pointer are taken
+// for garbage
+#define PROFILER_MAX_STACK (64 << 20)
+// lets a handler that started before the timer was stopped finish
+#define PROFILER_SETTLE_US 10000
+
+#define PROFILER_IDLE 0
+#define PROFILER_SIGNALLED 1
+#define PROFILER_RUNNING 2
+#define PROFILER_WRITING 3
+
+namespace {
+
+struct Sample {
+  uint32_t depth;
+  uint32_t padding;
+  uintptr_t pcs[PROFILER_MAX_DEPTH];
+};
+
+struct Chunk {
+  volatile uint32_t count;
+  uint32_t padding;
+  Sample samples[PROFILER_CHUNK_SAMPLES];
+};
+
+// everything the signal handlers touch
+Chunk* chunks;
+uint32_t num_chunks;
+long interval_us;
+int signal_seconds;
+volatile uint32_t next_chunk;
+volatile uint32_t session;
+volatile uint32_t dropped;
+volatile sig_atomic_t active;
+volatile int state;
+volatile long long deadline_us;
+
+__thread Chunk* thread_chunk;
+__thread uint32_t thread_session;
+
+long long NowMicros() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Async-signal-safe, as is Disarm.
+void Arm(int seconds) {
+  next_chunk = 0;
+  dropped = 0;
+  ++session;
+  deadline_us = NowMicros() + seconds * 1000000LL;
+  __sync_synchronize();
+  active = 1;
+
+  itimerval timer;
+  timer.it_interval.tv_sec = interval_us / 1000000;
+  timer.it_interval.tv_usec = interval_us % 1000000;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void Disarm() {
+  itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  active = 0;
+}
+
+// Reads the frame record at |fp|.  The kernel reports EFAULT for
+// unmapped and PROT_NONE pages (guard pages, reserved arena space)
+// instead of faulting, where a plain load would crash the handler.
+bool ReadFrame(uintptr_t fp, uintptr_t* record) {
+  iovec local, remote;
+  local.iov_base = record;
+  local.iov_len = 2 * sizeof(uintptr_t);
+  remote.iov_base = (void*)fp;
+  remote.iov_len = local.iov_len;
+  return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) ==
+      (ssize_t)local.iov_len;
+}
+
+uint32_t Unwind(const ucontext_t* context, uintptr_t* pcs) {
+  uintptr_t pc, fp, sp;
+#if defined(__x86_64__)
+  pc = context->uc_mcontext.gregs[REG_RIP];
+  fp = context->uc_mcontext.gregs[REG_RBP];
+  sp = context->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+  pc = context->uc_mcontext.pc;
+  fp = context->uc_mcontext.regs[29];
+  sp = context->uc_mcontext.sp;
+#else
+  pcs[0] = 0;
+  return 0;
+#endif
+
+  uint32_t depth = 0;
+  pcs[depth++] = pc;
+  // each frame record is the caller's frame pointer, then the return
+  // address; code without frame pointers leaves anything in the register
+  while (depth < PROFILER_MAX_DEPTH) {
+    if (fp < sp || fp - sp > PROFILER_MAX_STACK ||
+        fp % sizeof(uintptr_t) != 0)
+      break;
+    uintptr_t record[2];
+    if (!ReadFrame(fp, record))
+      break;
+    uintptr_t next = record[0];
+    uintptr_t ret = record[1];
+    if (ret == 0)
+      break;
+    // the call, not the instruction after it
+    pcs[depth++] = ret - 1;
+    if (next <= fp)
+      break;
+    sp = fp;
+    fp = next;
+  }
+  return depth;
+}
+
+void OnProfileSignal(int signum, siginfo_t* info, void* context) {
+  if (!active)
+    return;
+  int saved_errno = errno;
+
+  if (NowMicros() >= deadline_us) {
+    Disarm();
+    errno = saved_errno;
+    return;
+  }
+
+  Chunk* chunk = thread_chunk;
+  if (thread_session != session || chunk == NULL ||
+      chunk->count == PROFILER_CHUNK_SAMPLES) {
+    thread_session = session;
+    uint32_t index = __sync_fetch_and_add(&next_chunk, 1);
+    chunk = index < num_chunks ? &chunks[index] : NULL;
+    thread_chunk = chunk;
+    if (chunk == NULL) {
+      __sync_fetch_and_add(&dropped, 1);
+      errno = saved_errno;
+      return;
+    }
+    chunk->count = 0;
+  }
+
+  Sample* sample = &chunk->samples[chunk->count];
+  sample->depth = Unwind((const ucontext_t*)context, sample->pcs);
+  __sync_synchronize();
+  chunk->count = chunk->count + 1;
+  errno = saved_errno;
+}
+
+void OnStartSignal(int signum) {
+  if (__sync_bool_compare_and_swap(&state, PROFILER_IDLE, PROFILER_SIGNALLED)) {
+    int saved_errno = errno;
+    Arm(signal_seconds);
+    errno = saved_errno;
+  }
+}
+
+void Settle() {
+  timespec delay;
+  delay.tv_sec = 0;
+  delay.tv_nsec = PROFILER_SETTLE_US * 1000L;
+  nanosleep(&delay, NULL);
+}
+
+std::string Symbol(uintptr_t pc) {
+  Dl_info info;
+  char buf[64];
+  if (dladdr((void*)pc, &info) == 0) {
+    snprintf(buf, sizeof(buf), "[0x%lx]", (unsigned long)pc);
+    return buf;
+  }
+  std::string name;
+  if (info.dli_sname != NULL) {
+    int status;
+    char* demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL,
+                                          &status);
+    name = demangled != NULL ? demangled : info.dli_sname;
+    free(demangled);
+  } else {
+    const char* module = info.dli_fname != NULL ? info.dli_fname : "";
+    const char* slash = strrchr(module, '/');
+    snprintf(buf, sizeof(buf), "+0x%lx",
+             (unsigned long)(pc - (uintptr_t)info.dli_fbase));
+    name = std::string(slash != NULL ? slash + 1 : module) + buf;
+  }
+  // ';' separates frames in the folded format
+  std::replace(name.begin(), name.end(), ';', ':');
+  return name;
+}
+
+bool ByCount(const std::pair<std::string, long>& a,
+             const std::pair<std::string, long>& b) {
+  return a.second > b.second;
+}
+
+}
+
+Profiler::Profiler(int hz, long max_samples, int seconds,
+                   const std::string& output)
+    : output(output) {
+  num_chunks = std::max(1L, max_samples / PROFILER_CHUNK_SAMPLES);
+  // touched only as it fills
+  void* p = mmap(NULL, num_chunks * sizeof(Chunk), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {
+    perror("mmap");
+    throw std::exception();
+  }
+  chunks = (Chunk*)p;
+  interval_us = std::max(1000000L / std::max(hz, 1), 1L);
+  signal_seconds = seconds;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = OnProfileSignal;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, NULL);
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = OnStartSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, NULL);
+}
+
+bool Profiler::Run(int seconds, std::string* folded) {
+  if (!__sync_bool_compare_and_swap(&state, PROFILER_IDLE, PROFILER_RUNNING))
+    return false;
+
+  Arm(seconds);
+  long long left;
+  while ((left = deadline_us - NowMicros()) > 0) {
+    timespec delay;
+    delay.tv_sec = left / 1000000;
+    delay.tv_nsec = left % 1000000 * 1000;
+    nanosleep(&delay, NULL);
+  }
+  Disarm();
+  Settle();
+  Fold(folded);
+  state = PROFILER_IDLE;
+  return true;
+}
+
+void Profiler::Poll() {
+  if (state != PROFILER_SIGNALLED || NowMicros() < deadline_us ||
+      !__sync_bool_compare_and_swap(&state, PROFILER_SIGNALLED,
+                                    PROFILER_WRITING))
+    return;
+
+  Disarm();
+  Settle();
+  std::string folded;
+  Fold(&folded);
+  // an idle process, such as a parent waiting for its workers, has
+  // nothing to show
+  if (!folded.empty()) {
+    char name[64];
+    snprintf(name, sizeof(name), ".%d.folded", (int)getpid());
+    std::string path = output + name;
+    FILE* file = fopen(path.c_str(), "we");
+    if (file == NULL || fwrite(folded.data(), 1, folded.length(), file) !=
+        folded.length())
+      perror("profile");
+    else
+      fprintf(stderr, "Profile written to %s\n", path.c_str());
+    if (file != NULL)
+      fclose(file);
+  }
+  state = PROFILER_IDLE;
+}
+
+void Profiler::Fold(std::string* folded) {
+  std::map<std::vector<uintptr_t>, long> stacks;
+  uint32_t used = std::min((uint32_t)next_chunk, num_chunks);
+  long samples = 0;
+  for (uint32_t i = 0; i < used; ++i) {
+    const Chunk& chunk = chunks[i];
+    for (uint32_t j = 0; j < chunk.count; ++j) {
+      const Sample& sample = chunk.samples[j];
+      // a leaf without a frame pointer (in libc, say) can send the walk
+      // into garbage; end the stack where the addresses stop being code
+      uint32_t depth = 1;
+      Dl_info info;
+      while (depth < sample.depth && dladdr((void*)sample.pcs[depth], &info))
+        ++depth;
+      ++stacks[std::vector<uintptr_t>(sample.pcs, sample.pcs + depth)];
+      ++samples;
+    }
+  }
+
+  // different addresses in the same functions fold into one line
+  std::map<uintptr_t, std::string> names;
+  std::map<std::string, long> lines;
+  for (std::map<std::vector<uintptr_t>, long>::const_iterator it =
+           stacks.begin(); it != stacks.end(); ++it) {
+    std::string line;
+    for (size_t i = it->first.size(); i > 0; --i) {
+      uintptr_t pc = it->first[i - 1];
+      std::map<uintptr_t, std::string>::iterator name = names.find(pc);
+      if (name == names.end())
+        name = names.insert(std::make_pair(pc, Symbol(pc))).first;
+      if (!line.empty())
+        line += ';';
+      line += name->second;
+    }
+    lines[line] += it->second;
+  }
+
+  std::vector<std::pair<std::string, long> > sorted(lines.begin(),
+                                                    lines.end());
+  std::sort(sorted.begin(), sorted.end(), ByCount);
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    char count[32];
+    snprintf(count, sizeof(count), " %ld\n", sorted[i].second);
+    *folded += sorted[i].first;
+    *folded += count;
+  }
+  if (dropped > 0)
+    fprintf(stderr, "Profile: %ld samples, %u dropped for lack of space\n",
+            samples, (unsigned)dropped);
+}
+
+ProfileHandler::ProfileHandler(Profiler* profiler, const HttpServer* server)
+    : profiler(profiler), server(server) {
+}
+
+void ProfileHandler::Handle(const HttpRequest& req, const RouteMatch& match,
+                            ResponseWriter* response) {
+  if (req.method != "GET" || server->multi_process) {
+    response->SendStatus("501 Not Implemented");
+    return;
+  }
+
+  int seconds = 5;
+  size_t query = req.uri.find('?');
+  if (query != std::string::npos) {
+    size_t at = req.uri.find("seconds=", query);
+    if (at != std::string::npos)
+      seconds = atoi(req.uri.c_str() + at + strlen("seconds="));
+  }
+  seconds = std::max(1, std::min(seconds, 60));
+
+  std::string folded;
+  if (!profiler->Run(seconds, &folded)) {
+    response->SendStatus("409 Conflict");
+    return;
+  }
+  response->AddHeader("Content-Type", "text/plain");
+  response->AddHeader("Cache-Control", "no-store");
+  response->Write(folded);
+}
@@ -0,0 +1,82 @@
+/*
+ * profiler.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROFILER_HPP_
+#define PROFILER_HPP_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "router.hpp"
+
+class HttpServer;
+
+// Sampling CPU profiler built into the server.  While a profile runs,
+// ITIMER_PROF raises SIGPROF after every 1/hz seconds of CPU time the
+// process uses, in the thread that used it.  The handler walks that
+// thread's frame pointers (the binaries are built with
+// -fno-omit-frame-pointer) and appends the stack to a chunk of samples
+// the thread reserved from a per-process arena with an atomic add, so no
+// two threads write the same chunk and the handler never locks.  The
+// stacks are then counted and symbolized with dladdr (the binaries link
+// with -rdynamic) into the folded format flamegraph.pl reads.
+//
+// A profile is started by SIGUSR1, which writes the result to a file
+// once it is done, or by a request to ProfileHandler.  There is one
+// profiler per process.
+class Profiler {
+ public:
+  // |seconds| is how long a SIGUSR1 profile runs; it is written to
+  // |output|.<pid>.folded.
+  Profiler(int hz, long max_samples, int seconds, const std::string& output);
+
+  // Profiles for |seconds| and appends the folded stacks to |folded|.
+  // Returns false if a profile is already running.
+  bool Run(int seconds, std::string* folded);
+
+  // Ends a signalled profile that is due and writes it out.  Called from
+  // the accept loops, since the signal handlers can't.
+  void Poll();
+
+ private:
+  std::string output;
+
+  void Fold(std::string* folded);
+};
+
+// GET path?seconds=N profiles the process answering it for N seconds
+// (5 by default, at most 60) and returns the folded stacks.  A server
+// with several worker processes answers 501: the request would profile
+// one worker, and in myhttpdp only its own wait.  Send those SIGUSR1
+// instead, which every worker answers with a file of its own.
+class ProfileHandler : public HttpHandler {
+ public:
+  ProfileHandler(Profiler* profiler, const HttpServer* server);
+  void Handle(const HttpRequest& req, const RouteMatch& match,
+              ResponseWriter* response);
+
+ private:
+  Profiler* profiler;
+  const HttpServer* server;
+};
+
+#endif
@@ -0,0 +1,766 @@
+/*
+ * proxy.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "http_request.hpp"
+#include "probes.hpp"
+#include "proxy.hpp"
+
+#define PROXY_BUFFER_SIZE 16384
+#define PROXY_MAX_IDLE 64
+#define PROXY_CACHE_ENTRIES 1024
+
+namespace {
+
+typedef std::vector<std::pair<std::string, std::string> > Headers;
+
+long long NowMillis() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+bool Contains(const std::string& value, const char* token) {
+  std::string lower = value;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  return lower.find(token) != std::string::npos;
+}
+
+bool IsHopByHop(const std::string& name) {
+  static const char* names[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer",
+    "Transfer-Encoding", "Upgrade", "Content-Length",
+  };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+    if (EqualsIgnoreCase(name, names[i]))
+      return true;
+  }
+  return false;
+}
+
+std::string FindHeader(const Headers& headers, const char* name) {
+  for (size_t i = 0; i < headers.size(); ++i) {
+    if (EqualsIgnoreCase(headers[i].first, name))
+      return headers[i].second;
+  }
+  return "";
+}
+
+bool HasHeader(const Headers& headers, const char* name) {
+  for (size_t i = 0; i < headers.size(); ++i) {
+    if (EqualsIgnoreCase(headers[i].first, name))
+      return true;
+  }
+  return false;
+}
+
+// Buffered reads from an upstream socket.  Errors and early EOF are
+// reported as false rather than thrown, since they are not the client's.
+class Upstream {
+ public:
+  explicit Upstream(int fd)
+      : fd(fd), pos(0), received(0), listener(NULL) {}
+
+  bool Fill() {
+    if (pos == buf.length()) {
+      buf.clear();
+      pos = 0;
+    }
+    char tmp[PROXY_BUFFER_SIZE];
+    ssize_t numread;
+    do {
+      numread = read(fd, tmp, sizeof(tmp));
+    } while (numread == -1 && errno == EINTR);
+    if (numread <= 0)
+      return false;
+    buf.append(tmp, numread);
+    received += numread;
+    return true;
+  }
+
+  bool ReadLine(std::string* line) {
+    size_t end;
+    while ((end = buf.find("\r\n", pos)) == std::string::npos) {
+      if (buf.length() - pos > PROXY_BUFFER_SIZE || !Fill())
+        return false;
+    }
+    line->assign(buf, pos, end - pos);
+    pos = end + 2;
+    return true;
+  }
+
+  // Reads the status line and headers into |head|.
+  bool ReadHead(std::string* head) {
+    size_t end;
+    while ((end = FindHeaderEnd(buf, pos)) == std::string::npos) {
+      if (buf.length() - pos > PROXY_BUFFER_SIZE * 4 || !Fill())
+        return false;
+    }
+    head->assign(buf, pos, end - pos);
+    pos = end;
+    return true;
+  }
+
+  // Copies |length| bytes, or everything up to EOF when |length| is -1,
+  // to the client and, while it fits, to |capture|.
+  bool Relay(long long length, int client, CapturedResponse* capture,
+             size_t max_capture) {
+    while (length != 0) {
+      if (pos == buf.length() && !Fill())
+        return length == -1;
+      size_t n = buf.length() - pos;
+      if (length != -1 && (long long)n > length)
+        n = length;
+      Write(client, buf.data() + pos, n);
+      if (capture != NULL && capture->complete) {
+        if (capture->body.length() + n <= max_capture) {
+          capture->body.append(buf, pos, n);
+        } else {
+          capture->complete = false;
+          std::string().swap(capture->body);
+          if (listener != NULL)
+            listener->Unshareable();
+        }
+      }
+      pos += n;
+      if (length != -1)
+        length -= n;
+    }
+    return true;
+  }
+
+  bool Drained() const {
+    return pos == buf.length();
+  }
+
+  int fd;
+  std::string buf;
+  size_t pos;
+  size_t received;
+  // told when the body outgrows the capture
+  CaptureListener* listener;
+};
+
+// Copies a chunked body, re-emitting the chunk framing when |reframe| and
+// just the data otherwise.
+bool RelayChunked(Upstream* in, int client, bool reframe,
+                  CapturedResponse* capture, size_t max_capture) {
+  std::string line;
+  while (true) {
+    if (!in->ReadLine(&line))
+      return false;
+    char* end;
+    long long size = strtoll(line.c_str(), &end, 16);
+    if (end == line.c_str() || size < 0)
+      return false;
+    if (reframe)
+      Write(client, line + "\r\n");
+
+    if (size == 0) {
+      // trailers end with an empty line
+      do {
+        if (!in->ReadLine(&line))
+          return false;
+        if (reframe)
+          Write(client, line + "\r\n");
+      } while (!line.empty());
+      return true;
+    }
+
+    if (!in->Relay(size, client, capture, max_capture))
+      return false;
+    if (!in->ReadLine(&line) || !line.empty())
+      return false;
+    if (reframe)
+      Write(client, "\r\n");
+  }
+}
+
+// Streams a request body of |length| bytes from the client to upstream.
+bool RelayRequestBody(int client, std::string* pending, int upstream,
+                      long long length) {
+  size_t n = std::min((long long)pending->length(), length);
+  if (n > 0) {
+    if (send(upstream, pending->data(), n, MSG_NOSIGNAL) != (ssize_t)n)
+      return false;
+    pending->erase(0, n);
+    length -= n;
+  }
+
+  char buf[PROXY_BUFFER_SIZE];
+  while (length > 0) {
+    ssize_t numread = read(client, buf,
+                           std::min((long long)sizeof(buf), length));
+    if (numread == -1 && errno == EINTR)
+      continue;
+    if (numread == -1)
+      throw errno;
+    if (numread == 0)
+      throw ECONNRESET;
+    for (ssize_t sent = 0; sent < numread; ) {
+      ssize_t cnt = send(upstream, buf + sent, numread - sent, MSG_NOSIGNAL);
+      if (cnt == -1)
+        return false;
+      sent += cnt;
+    }
+    length -= numread;
+  }
+  return true;
+}
+
+// Streams a chunked request body from the client to upstream, framing
+// included; whatever the client sent after it is left in |pending|.
+// Returns false when upstream can't take it.
+bool RelayRequestChunked(int client, std::string* pending, int upstream) {
+  Upstream in(client);
+  in.buf.swap(*pending);
+  bool relayed;
+  try {
+    relayed = RelayChunked(&in, upstream, true, NULL, 0);
+  } catch (int error_num) {
+    return false;
+  }
+  // the client hung up or broke the framing mid-body
+  if (!relayed)
+    throw ECONNRESET;
+  pending->assign(in.buf, in.pos, std::string::npos);
+  return true;
+}
+
+void SendError(int fd, const std::string& http_mode, const char* status) {
+  Write(fd, http_mode + " " + status + "\r\nContent-Length: 0\r\n"
+        "Connection: close\r\n\r\n");
+  HTTPD_PROBE1(headers__sent, fd);
+}
+
+std::string PathOf(const std::string& uri) {
+  if (!uri.empty() && uri[0] == '/')
+    return uri;
+  if (uri.find("://") == std::string::npos)
+    return "";
+  try {
+    return PathFromUri(uri);
+  } catch (std::exception&) {
+    return "";
+  }
+}
+
+}
+
+ReverseProxy::ReverseProxy(const std::string& spec, int timeout,
+                           long cache_ms, size_t max_capture)
+    : timeout(timeout), cache_ms(cache_ms), max_capture(max_capture) {
+  pthread_mutex_init(&flights_mutex, NULL);
+  pthread_mutex_init(&cache_mutex, NULL);
+
+  std::istringstream iss(spec);
+  std::string entry;
+  while (std::getline(iss, entry, ',')) {
+    size_t eq = entry.find('=');
+    size_t colon = entry.rfind(':');
+    if (eq == std::string::npos || colon == std::string::npos ||
+        colon < eq || entry[0] != '/') {
+      fprintf(stderr, "Invalid proxy route: %s\n", entry.c_str());
+      throw std::exception();
+    }
+
+    ProxyRoute* route = new ProxyRoute;
+    route->prefix = entry.substr(0, eq);
+    route->host = entry.substr(eq + 1, colon - eq - 1);
+    sscanf(entry.c_str() + colon + 1, "%d", &route->port);
+    pthread_mutex_init(&route->mutex, NULL);
+
+    struct addrinfo hints, *servinfo;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    int rv = getaddrinfo(route->host.c_str(), NULL, &hints, &servinfo);
+    if (rv != 0) {
+      fprintf(stderr, "getaddrinfo %s: %s\n", route->host.c_str(),
+              gai_strerror(rv));
+      throw std::exception();
+    }
+    memcpy(&route->address, servinfo->ai_addr, sizeof(route->address));
+    route->address.sin_port = htons(route->port);
+    freeaddrinfo(servinfo);
+
+    routes.push_back(route);
+  }
+}
+
+ReverseProxy::~ReverseProxy() {
+  for (size_t i = 0; i < routes.size(); ++i) {
+    for (size_t j = 0; j < routes[i]->idle.size(); ++j)
+      close(routes[i]->idle[j]);
+    pthread_mutex_destroy(&routes[i]->mutex);
+    delete routes[i];
+  }
+  pthread_mutex_destroy(&flights_mutex);
+  pthread_mutex_destroy(&cache_mutex);
+}
+
+ProxyRoute* ReverseProxy::Match(const std::string& uri) {
+  std::string path = PathOf(uri);
+  ProxyRoute* best = NULL;
+  for (size_t i = 0; i < routes.size(); ++i) {
+    const std::string& prefix = routes[i]->prefix;
+    if (path.compare(0, prefix.length(), prefix) != 0)
+      continue;
+    // /api matches /api, /api/x and /api?x, but not /apix
+    size_t end = prefix.length();
+    if (end < path.length() && prefix[end - 1] != '/' && path[end] != '/' &&
+        path[end] != '?')
+      continue;
+    if (best == NULL || prefix.length() > best->prefix.length())
+      best = routes[i];
+  }
+  return best;
+}
+
+int ReverseProxy::Acquire(ProxyRoute* route, bool* reused) {
+  pthread_mutex_lock(&route->mutex);
+  while (!route->idle.empty()) {
+    int upstream = route->idle.back();
+    route->idle.pop_back();
+
+    // an idle connection with something to read was closed upstream
+    pollfd p;
+    p.fd = upstream;
+    p.events = POLLIN;
+    p.revents = 0;
+    if (poll(&p, 1, 0) == 0) {
+      pthread_mutex_unlock(&route->mutex);
+      *reused = true;
+      return upstream;
+    }
+    close(upstream);
+  }
+  pthread_mutex_unlock(&route->mutex);
+
+  *reused = false;
+  int upstream = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (upstream == -1) {
+    perror("proxy: socket");
+    return -1;
+  }
+  if (connect(upstream, (sockaddr*)&route->address,
+              sizeof(route->address)) == -1) {
+    perror("proxy: connect");
+    close(upstream);
+    return -1;
+  }
+
+  int on = 1;
+  setsockopt(upstream, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  struct timeval tv;
+  tv.tv_sec = timeout;
+  tv.tv_usec = 0;
+  setsockopt(upstream, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  return upstream;
+}
+
+void ReverseProxy::Release(ProxyRoute* route, int upstream) {
+  pthread_mutex_lock(&route->mutex);
+  if (route->idle.size() < PROXY_MAX_IDLE) {
+    route->idle.push_back(upstream);
+    upstream = -1;
+  }
+  pthread_mutex_unlock(&route->mutex);
+  if (upstream != -1)
+    close(upstream);
+}
+
+bool ReverseProxy::Forward(ProxyRoute* route, const HttpRequest& req, int fd,
+                           std::string* pending,
+                           const std::string& http_mode) {
+  // credentialed requests may get a response meant for that user alone
+  bool coalesce = req.method == "GET" &&
+      req.GetHeader("Content-Length").empty() &&
+      req.GetHeader("Transfer-Encoding").empty() &&
+      req.GetHeader("Authorization").empty() &&
+      req.GetHeader("Cookie").empty();
+  bool complete;
+  if (!coalesce)
+    return Fetch(route, req, fd, pending, http_mode, NULL, NULL, &complete);
+
+  std::string key = route->prefix + "\n" + req.GetHeader("Host") + "\n" +
+      PathOf(req.uri);
+
+  CapturedResponse cached;
+  if (cache_ms > 0 && LookupCache(key, &cached))
+    return Replay(cached, req, fd, http_mode);
+
+  pthread_mutex_lock(&flights_mutex);
+  std::map<std::string, Flight*>::iterator it = flights.find(key);
+  if (it != flights.end()) {
+    // an identical request is already upstream; wait for its response
+    Flight* flight = it->second;
+    ++flight->refs;
+    while (!flight->finished && !flight->unshared)
+      pthread_cond_wait(&flight->done, &flights_mutex);
+    // an unshared response may still be being written
+    bool shared = !flight->unshared && flight->response.complete &&
+        flight->response.shareable;
+    if (shared)
+      cached = flight->response;
+    pthread_mutex_unlock(&flights_mutex);
+    ReleaseFlight(flight);
+
+    if (shared)
+      return Replay(cached, req, fd, http_mode);
+    return Fetch(route, req, fd, pending, http_mode, NULL, NULL, &complete);
+  }
+
+  Flight* flight = new Flight;
+  flight->proxy = this;
+  flight->key = key;
+  pthread_cond_init(&flight->done, NULL);
+  flight->unshared = false;
+  flight->finished = false;
+  flight->refs = 1;
+  flights[key] = flight;
+  pthread_mutex_unlock(&flights_mutex);
+
+  complete = false;
+  bool keep_alive = false;
+  int error_num = 0;
+  try {
+    keep_alive = Fetch(route, req, fd, pending, http_mode, &flight->response,
+                       flight, &complete);
+  } catch (int e) {
+    error_num = e;
+  }
+
+  if (!complete)
+    flight->response.complete = false;
+  if (complete && cache_ms > 0 &&
+      flight->response.status.compare(0, 3, "200") == 0)
+    StoreCache(key, flight->response);
+
+  // wake the followers even when our own client went away
+  pthread_mutex_lock(&flights_mutex);
+  flight->finished = true;
+  EndFlight(flight);
+  pthread_mutex_unlock(&flights_mutex);
+  ReleaseFlight(flight);
+
+  if (error_num != 0)
+    throw error_num;
+  return keep_alive;
+}
+
+bool ReverseProxy::Fetch(ProxyRoute* route, const HttpRequest& req, int fd,
+                         std::string* pending, const std::string& http_mode,
+                         CapturedResponse* capture, CaptureListener* listener,
+                         bool* complete) {
+  *complete = false;
+  std::string path = PathOf(req.uri);
+
+  std::string content_length = req.GetHeader("Content-Length");
+  long long body_length = 0;
+  if (!content_length.empty())
+    body_length = atoll(content_length.c_str());
+  std::string transfer_encoding = req.GetHeader("Transfer-Encoding");
+  bool chunked_body = !transfer_encoding.empty();
+  if (chunked_body && !EqualsIgnoreCase(transfer_encoding, "chunked")) {
+    SendError(fd, http_mode, "501 Not Implemented");
+    HTTPD_PROBE1(connection__close, fd);
+    close(fd);
+    return false;
+  }
+  if (chunked_body)
+    body_length = 0;
+
+  std::string head = req.method + " " + path + " HTTP/1.1\r\n";
+  for (size_t i = 0; i < req.headers.size(); ++i) {
+    if (IsHopByHop(req.headers[i].first))
+      continue;
+    head += req.headers[i].first + ": " + req.headers[i].second + "\r\n";
+  }
+  if (req.GetHeader("Host").empty()) {
+    char host[300];
+    snprintf(host, sizeof(host), "Host: %s:%d\r\n", route->host.c_str(),
+             route->port);
+    head += host;
+  }
+  sockaddr_in peer;
+  socklen_t peer_len = sizeof(peer);
+  if (getpeername(fd, (sockaddr*)&peer, &peer_len) == 0 &&
+      peer.sin_family == AF_INET) {
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address));
+    head += std::string("X-Forwarded-For: ") + address + "\r\n";
+  }
+  if (chunked_body) {
+    head += "Transfer-Encoding: chunked\r\n";
+  } else if (body_length > 0) {
+    char length[64];
+    snprintf(length, sizeof(length), "Content-Length: %lld\r\n", body_length);
+    head += length;
+  }
+  head += "\r\n";
+
+  int upstream = -1;
+  bool reused = false;
+  std::string response_head;
+  for (int attempt = 0; ; ++attempt) {
+    upstream = Acquire(route, &reused);
+    if (upstream == -1) {
+      SendError(fd, http_mode, "502 Bad Gateway");
+      HTTPD_PROBE1(connection__close, fd);
+      close(fd);
+      return false;
+    }
+
+    Upstream in(upstream);
+    in.listener = listener;
+    bool sent = send(upstream, head.data(), head.length(), MSG_NOSIGNAL) ==
+        (ssize_t)head.length();
+    try {
+      if (sent && chunked_body)
+        sent = RelayRequestChunked(fd, pending, upstream);
+      else if (sent && body_length > 0)
+        sent = RelayRequestBody(fd, pending, upstream, body_length);
+    } catch (int error_num) {
+      close(upstream);
+      throw error_num;
+    }
+
+    bool headed = sent && in.ReadHead(&response_head) &&
+        response_head.length() > 12;
+    // skip interim 1xx responses
+    while (headed && response_head[9] == '1' &&
+           response_head.compare(9, 3, "101") != 0) {
+      headed = in.ReadHead(&response_head) && response_head.length() > 12;
+    }
+
+    if (!headed) {
+      close(upstream);
+      // a pooled connection may have been closed under us; retry once
+      // when nothing from the request is lost by doing so
+      if (reused && attempt == 0 && body_length == 0 && !chunked_body &&
+          in.received == 0)
+        continue;
+      SendError(fd, http_mode, "502 Bad Gateway");
+      HTTPD_PROBE1(connection__close, fd);
+      close(fd);
+      return false;
+    }
+
+    // parse the status line and headers
+    size_t status_end = response_head.find("\r\n");
+    std::string status_line = response_head.substr(0, status_end);
+    size_t space = status_line.find(' ');
+    std::string upstream_version = status_line.substr(0, space);
+    std::string status = space == std::string::npos ? "502 Bad Gateway" :
+        status_line.substr(space + 1);
+    int code = atoi(status.c_str());
+    Headers headers;
+    ParseHeaders(response_head, status_end, &headers);
+
+    bool no_body = req.method == "HEAD" || code == 204 || code == 304 ||
+        (code >= 100 && code < 200);
+    bool chunked = !no_body &&
+        Contains(FindHeader(headers, "Transfer-Encoding"), "chunked");
+    bool has_length = !no_body && !chunked &&
+        HasHeader(headers, "Content-Length");
+    long long length = has_length ?
+        atoll(FindHeader(headers, "Content-Length").c_str()) : -1;
+
+    bool upstream_keep_alive = upstream_version == "HTTP/1.1" &&
+        !Contains(FindHeader(headers, "Connection"), "close") &&
+        (no_body || chunked || has_length);
+    bool reframe = chunked && http_mode == "HTTP/1.1" &&
+        req.http_mode == "HTTP/1.1";
+    bool client_close = !no_body && !has_length && !reframe;
+
+    std::string filtered;
+    for (size_t i = 0; i < headers.size(); ++i) {
+      if (IsHopByHop(headers[i].first))
+        continue;
+      filtered += headers[i].first + ": " + headers[i].second + "\r\n";
+    }
+    if (capture != NULL) {
+      capture->status = status;
+      capture->headers = filtered;
+      // the key doesn't hold the request headers a Vary response depends on
+      capture->shareable = !HasHeader(headers, "Set-Cookie") &&
+          !HasHeader(headers, "Vary") &&
+          !Contains(FindHeader(headers, "Cache-Control"), "no-store") &&
+          !Contains(FindHeader(headers, "Cache-Control"), "private");
+      // nor would a body known not to fit
+      if (has_length && length > (long long)max_capture)
+        capture->complete = false;
+      if ((!capture->shareable || !capture->complete) && listener != NULL)
+        listener->Unshareable();
+    }
+
+    std::string client_head = http_mode + " " + status + "\r\n" + filtered;
+    if (has_length || (no_body && HasHeader(headers, "Content-Length")))
+      client_head += "Content-Length: " +
+          FindHeader(headers, "Content-Length") + "\r\n";
+    if (reframe)
+      client_head += "Transfer-Encoding: chunked\r\n";
+    if (client_close && http_mode == "HTTP/1.1")
+      client_head += "Connection: close\r\n";
+
+    bool relayed;
+    try {
+      Write(fd, client_head);
+      EndHeaders(fd, req.http_mode, http_mode);
+      if (no_body)
+        relayed = true;
+      else if (chunked)
+        relayed = RelayChunked(&in, fd, reframe, capture, max_capture);
+      else
+        relayed = in.Relay(length, fd, capture, max_capture);
+    } catch (int error_num) {
+      close(upstream);
+      throw error_num;
+    }
+
+    if (relayed && upstream_keep_alive && in.Drained())
+      Release(route, upstream);
+    else
+      close(upstream);
+
+    if (!relayed || client_close) {
+      // the client can't tell where a truncated body ends
+      HTTPD_PROBE1(connection__close, fd);
+      close(fd);
+      *complete = relayed;
+      return false;
+    }
+
+    HTTPD_PROBE2(body__complete, fd, (long)in.received);
+    *complete = true;
+    if (http_mode == "HTTP/1.0") {
+      EndResponse(fd, http_mode);
+      return false;
+    }
+    return true;
+  }
+}
+
+bool ReverseProxy::Replay(const CapturedResponse& response,
+                          const HttpRequest& req, int fd,
+                          const std::string& http_mode) {
+  char length[64];
+  snprintf(length, sizeof(length), "Content-Length: %lu\r\n",
+           (unsigned long)response.body.length());
+  Write(fd, http_mode + " " + response.status + "\r\n" + response.headers +
+        length);
+  EndHeaders(fd, req.http_mode, http_mode);
+  Write(fd, response.body);
+  HTTPD_PROBE2(body__complete, fd, (long)response.body.length());
+  EndResponse(fd, http_mode);
+  return http_mode != "HTTP/1.0";
+}
+
+void ReverseProxy::Flight::Unshareable() {
+  pthread_mutex_lock(&proxy->flights_mutex);
+  if (!unshared) {
+    unshared = true;
+    proxy->EndFlight(this);
+  }
+  pthread_mutex_unlock(&proxy->flights_mutex);
+}
+
+// Takes |flight| out of the map, so later requests start their own, and
+// wakes its followers.  Called with flights_mutex held.
+void ReverseProxy::EndFlight(Flight* flight) {
+  std::map<std::string, Flight*>::iterator it = flights.find(flight->key);
+  if (it != flights.end() && it->second == flight)
+    flights.erase(it);
+  pthread_cond_broadcast(&flight->done);
+}
+
+void ReverseProxy::ReleaseFlight(Flight* flight) {
+  pthread_mutex_lock(&flights_mutex);
+  bool last = --flight->refs == 0;
+  pthread_mutex_unlock(&flights_mutex);
+  if (last) {
+    pthread_cond_destroy(&flight->done);
+    delete flight;
+  }
+}
+
+bool ReverseProxy::LookupCache(const std::string& key,
+                               CapturedResponse* response) {
+  bool hit = false;
+  pthread_mutex_lock(&cache_mutex);
+  std::map<std::string, CacheEntry>::iterator it = cache.find(key);
+  if (it != cache.end()) {
+    if (it->second.expires > NowMillis()) {
+      *response = it->second.response;
+      hit = true;
+    } else {
+      cache.erase(it);
+    }
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  return hit;
+}
+
+void ReverseProxy::StoreCache(const std::string& key,
+                              const CapturedResponse& response) {
+  if (!response.complete || !response.shareable)
+    return;
+
+  long long now = NowMillis();
+  pthread_mutex_lock(&cache_mutex);
+  if (cache.size() >= PROXY_CACHE_ENTRIES) {
+    std::map<std::string, CacheEntry>::iterator it = cache.begin();
+    while (it != cache.end()) {
+      if (it->second.expires <= now)
+        cache.erase(it++);
+      else
+        ++it;
+    }
+  }
+  if (cache.size() < PROXY_CACHE_ENTRIES) {
+    CacheEntry& entry = cache[key];
+    entry.expires = now + cache_ms;
+    entry.response = response;
+  }
+  pthread_mutex_unlock(&cache_mutex);
+}
@@ -0,0 +1,127 @@
+/*
+ * proxy.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROXY_HPP_
+#define PROXY_HPP_
+
+#include <netinet/in.h>
+#include <pthread.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+struct HttpRequest;
+
+// Path prefix forwarded to one upstream, with its idle keep-alive
+// connections.
+struct ProxyRoute {
+  std::string prefix;
+  std::string host;
+  int port;
+  sockaddr_in address;
+  pthread_mutex_t mutex;
+  std::vector<int> idle;
+};
+
+// Told by the thread capturing a response as soon as it can't be shared,
+// so the requests waiting on it needn't wait for the whole transfer.
+class CaptureListener {
+ public:
+  virtual ~CaptureListener() {}
+  virtual void Unshareable() = 0;
+};
+
+// A response held in memory for coalesced requests and the micro-cache:
+// status without the HTTP version, filtered header lines and the body.
+struct CapturedResponse {
+  std::string status;
+  std::string headers;
+  std::string body;
+  bool complete;
+  bool shareable;
+
+  CapturedResponse() : complete(true), shareable(true) {}
+};
+
+class ReverseProxy {
+ public:
+  // |routes| is a comma separated list of prefix=host:port.
+  ReverseProxy(const std::string& routes, int timeout, long cache_ms,
+               size_t max_capture);
+  ~ReverseProxy();
+
+  // Longest route whose prefix starts the path of |uri| and ends at a
+  // segment boundary, or NULL.
+  ProxyRoute* Match(const std::string& uri);
+
+  // Relays |req| to the route's upstream and the response back to |fd|.
+  // Returns false when the client connection was closed.
+  bool Forward(ProxyRoute* route, const HttpRequest& req, int fd,
+               std::string* pending, const std::string& http_mode);
+
+ private:
+  struct Flight : public CaptureListener {
+    ReverseProxy* proxy;
+    std::string key;
+    pthread_cond_t done;
+    // set by Unshareable(): the followers fetch for themselves
+    bool unshared;
+    bool finished;
+    CapturedResponse response;
+    int refs;
+
+    void Unshareable();
+  };
+
+  struct CacheEntry {
+    long long expires;
+    CapturedResponse response;
+  };
+
+  std::vector<ProxyRoute*> routes;
+  int timeout;
+  long cache_ms;
+  size_t max_capture;
+
+  pthread_mutex_t flights_mutex;
+  std::map<std::string, Flight*> flights;
+
+  pthread_mutex_t cache_mutex;
+  std::map<std::string, CacheEntry> cache;
+
+  int Acquire(ProxyRoute* route, bool* reused);
+  void Release(ProxyRoute* route, int upstream);
+  // Returns whether the client connection is still open; |complete| is
+  // set when the whole response reached the client.
+  bool Fetch(ProxyRoute* route, const HttpRequest& req, int fd,
+             std::string* pending, const std::string& http_mode,
+             CapturedResponse* capture, CaptureListener* listener,
+             bool* complete);
+  bool Replay(const CapturedResponse& response, const HttpRequest& req,
+              int fd, const std::string& http_mode);
+  void EndFlight(Flight* flight);
+  void ReleaseFlight(Flight* flight);
+  bool LookupCache(const std::string& key, CapturedResponse* response);
+  void StoreCache(const std::string& key, const CapturedResponse& response);
+};
+
+#endif
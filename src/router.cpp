@@ -0,0 +1,578 @@
+/*
+ * router.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <deque>
+#include <exception>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bandwidth.hpp"
+#include "content_cache.hpp"
+#include "hot_paths.hpp"
+#include "http_request.hpp"
+#include "probes.hpp"
+#include "router.hpp"
+
+// bodies up to this size are sent in the same write as the headers
+#define ROUTER_FLUSH_SIZE 16384
+
+std::string RouteMatch::Param(const char* name) const {
+  for (int i = 0; i < num_params; ++i) {
+    if (strcmp(param_names[i], name) == 0)
+      return std::string(params[i], param_lengths[i]);
+  }
+  return "";
+}
+
+ResponseWriter::ResponseWriter(int fd, const HttpRequest& req,
+                               const std::string& http_mode, bool keep_alive,
+                               SendPacer* pacer)
+    : fd(fd), http_version(req.http_mode), http_mode(http_mode),
+      head_only(req.method == "HEAD"), status("200 OK"), headers_sent(false),
+      chunked(false), keep_alive(keep_alive && http_mode != "HTTP/1.0"),
+      pacer(pacer), fixed_length(false), finished(false), body_bytes(0),
+      transfer_micros(0) {
+  start.tv_sec = 0;
+  start.tv_usec = 0;
+}
+
+void ResponseWriter::SetStatus(const std::string& status) {
+  this->status = status;
+}
+
+void ResponseWriter::AddHeader(const std::string& name,
+                               const std::string& value) {
+  if (!headers_sent)
+    out += name + ": " + value + "\r\n";
+}
+
+void ResponseWriter::SendHeaders(const char* framing, size_t body_length) {
+  std::string head;
+  head.reserve(http_mode.length() + status.length() + out.length() +
+               strlen(framing) + 32 + body_length);
+  head += http_mode;
+  head += ' ';
+  head += status;
+  head += "\r\n";
+  head += out;
+  head += framing;
+  if (!keep_alive && http_version == "HTTP/1.1")
+    head += "Connection: close\r\n";
+  head += "\r\n";
+  out.swap(head);
+  headers_sent = true;
+  HTTPD_PROBE1(headers__sent, fd);
+  gettimeofday(&start, NULL);
+}
+
+void ResponseWriter::Write(const char* data, size_t length) {
+  if (fixed_length || finished)
+    return;
+  if (!headers_sent) {
+    // HTTP/1.0 has no chunked encoding; the body ends when we close
+    chunked = http_mode == "HTTP/1.1" && http_version == "HTTP/1.1";
+    if (!chunked)
+      keep_alive = false;
+    SendHeaders(chunked ? "Transfer-Encoding: chunked\r\n" : "",
+                ROUTER_FLUSH_SIZE);
+  }
+  if (head_only || length == 0)
+    return;
+
+  body_bytes += length;
+  if (chunked) {
+    char size[32];
+    snprintf(size, sizeof(size), "%lx\r\n", (unsigned long)length);
+    out += size;
+    out.append(data, length);
+    out += "\r\n";
+  } else {
+    out.append(data, length);
+  }
+  if (out.length() >= ROUTER_FLUSH_SIZE)
+    Flush();
+}
+
+void ResponseWriter::Write(const std::string& s) {
+  Write(s.data(), s.length());
+}
+
+void ResponseWriter::SendFile(int file, off_t size) {
+  if (headers_sent || finished)
+    return;
+  char content_length[48];
+  snprintf(content_length, sizeof(content_length),
+           "Content-Length: %lld\r\n", (long long)size);
+  SendHeaders(content_length,
+              !head_only && size <= ROUTER_FLUSH_SIZE ? size : 0);
+  fixed_length = true;
+  if (head_only || size == 0)
+    return;
+
+  if (size > ROUTER_FLUSH_SIZE && pacer != NULL && pacer->Limited()) {
+    Flush();
+    while (body_bytes < size) {
+      off_t length = pacer->Acquire(size - body_bytes, body_bytes == 0);
+      off_t sent = ::SendFile(fd, file, body_bytes, length);
+      body_bytes += sent;
+      if (sent < length)
+        break;
+    }
+  } else if (size > ROUTER_FLUSH_SIZE) {
+    Flush();
+    body_bytes = ::SendFile(fd, file, 0, size);
+  } else {
+    if (pacer != NULL && pacer->Limited())
+      pacer->Acquire(size, true);
+    size_t header_length = out.length();
+    out.resize(header_length + size);
+    while (body_bytes < size) {
+      ssize_t numread = pread(file, &out[header_length + body_bytes],
+                              size - body_bytes, body_bytes);
+      if (numread == -1 && errno == EINTR)
+        continue;
+      if (numread <= 0)
+        break;
+      body_bytes += numread;
+    }
+    out.resize(header_length + body_bytes);
+  }
+  // the file shrank under us; the client can only tell by the close
+  if (body_bytes < size)
+    keep_alive = false;
+}
+
+void ResponseWriter::SendBody(const char* data, size_t size) {
+  if (headers_sent || finished)
+    return;
+  char content_length[48];
+  snprintf(content_length, sizeof(content_length),
+           "Content-Length: %lld\r\n", (long long)size);
+  SendHeaders(content_length,
+              !head_only && size <= ROUTER_FLUSH_SIZE ? size : 0);
+  fixed_length = true;
+  if (head_only || size == 0)
+    return;
+
+  bool paced = pacer != NULL && pacer->Limited();
+  if (size <= ROUTER_FLUSH_SIZE) {
+    if (paced)
+      pacer->Acquire(size, true);
+    out.append(data, size);
+    body_bytes = size;
+    return;
+  }
+  Flush();
+  while ((size_t)body_bytes < size) {
+    size_t length = size - body_bytes;
+    if (paced)
+      length = pacer->Acquire(length, body_bytes == 0);
+    ::Write(fd, data + body_bytes, length);
+    body_bytes += length;
+  }
+}
+
+void ResponseWriter::SendStatus(const std::string& status) {
+  if (headers_sent || finished)
+    return;
+  this->status = status;
+  SendHeaders("Content-Length: 0\r\n", 0);
+  fixed_length = true;
+}
+
+void ResponseWriter::Flush() {
+  if (!out.empty()) {
+    ::Write(fd, out);
+    out.clear();
+  }
+}
+
+bool ResponseWriter::Finish() {
+  if (finished)
+    return keep_alive;
+  finished = true;
+
+  if (!headers_sent)
+    SendHeaders("Content-Length: 0\r\n", 0);
+  else if (chunked && !head_only)
+    out += "0\r\n\r\n";
+  Flush();
+  HTTPD_PROBE2(body__complete, fd, (long)body_bytes);
+
+  timeval end;
+  gettimeofday(&end, NULL);
+  transfer_micros = (long)((end.tv_sec - start.tv_sec) * 1000000L +
+                           end.tv_usec - start.tv_usec);
+
+  if (!keep_alive) {
+    HTTPD_PROBE1(connection__close, fd);
+    close(fd);
+  }
+  return keep_alive;
+}
+
+long ResponseWriter::TransferMicros() const {
+  return transfer_micros;
+}
+
+int ResponseWriter::GetFd() const {
+  return fd;
+}
+
+StaticFileHandler::StaticFileHandler(const std::string& http_root,
+                                     HotPaths* hot_paths, ContentCache* cache)
+    : http_root(http_root), hot_paths(hot_paths), cache(cache) {
+}
+
+void StaticFileHandler::Handle(const HttpRequest& req, const RouteMatch& match,
+                               ResponseWriter* response) {
+  if (req.method != "GET" && req.method != "HEAD") {
+    response->SendStatus("501 Not Implemented");
+    return;
+  }
+
+  std::string path;
+  if (ResolvePath(http_root, req.uri, &path) != 200) {
+    response->SendStatus("400 Bad Request");
+    return;
+  }
+
+  std::string body;
+  if (cache != NULL && cache->Lookup(path, &body)) {
+    HTTPD_PROBE3(file__resolved, response->GetFd(), req.uri.c_str(), 1);
+    if (hot_paths != NULL)
+      hot_paths->Record(match.path, match.path_length);
+    response->SendBody(body.data(), body.length());
+    return;
+  }
+
+  int file;
+  struct stat statbuf;
+  switch (OpenPath(path, &file, &statbuf)) {
+    case 403:
+      response->SendStatus("403 Forbidden");
+      return;
+    case 404:
+      response->SendStatus("404 Not Found");
+      return;
+  }
+  HTTPD_PROBE3(file__resolved, response->GetFd(), req.uri.c_str(), 0);
+  if (hot_paths != NULL)
+    hot_paths->Record(match.path, match.path_length);
+  off_t size = statbuf.st_size;
+
+  try {
+    // read small files whole, keep them for the other workers, and send
+    // them from memory
+    if (cache != NULL && S_ISREG(statbuf.st_mode) &&
+        (size_t)size <= cache->MaxBodySize()) {
+      body.resize(size);
+      off_t numread = 0;
+      while (numread < size) {
+        ssize_t cnt = pread(file, &body[numread], size - numread, numread);
+        if (cnt == -1 && errno == EINTR)
+          continue;
+        if (cnt <= 0)
+          break;
+        numread += cnt;
+      }
+      if (numread == size) {
+        cache->Store(path, statbuf, body.data(), size);
+        response->SendBody(body.data(), size);
+        close(file);
+        return;
+      }
+    }
+    response->SendFile(file, size);
+  } catch (int error_num) {
+    close(file);
+    throw error_num;
+  }
+  close(file);
+}
+
+namespace {
+
+// The uncompressed trie patterns are inserted into before Compile().
+struct BuildNode {
+  std::map<char, BuildNode*> children;
+  BuildNode* param;
+  int exact_route;
+  int prefix_route;
+
+  BuildNode() : param(NULL), exact_route(-1), prefix_route(-1) {}
+
+  ~BuildNode() {
+    for (std::map<char, BuildNode*>::iterator it = children.begin();
+         it != children.end(); ++it)
+      delete it->second;
+    delete param;
+  }
+};
+
+}
+
+// The longest prefix route passed so far, in case no route matches the
+// whole path.
+struct Router::PrefixMatch {
+  int route;
+  const char* end;
+  int num_params;
+  const char* params[ROUTER_MAX_PARAMS];
+  size_t param_lengths[ROUTER_MAX_PARAMS];
+};
+
+Router::Router() {
+  Compile();
+}
+
+void Router::Handle(const std::string& pattern, HttpHandler* handler) {
+  if (pattern.empty() || pattern[0] != '/') {
+    fprintf(stderr, "Route must start with /: %s\n", pattern.c_str());
+    throw std::exception();
+  }
+
+  Route route;
+  route.pattern = pattern;
+  route.handler = handler;
+  for (size_t pos = 0; pos < pattern.length(); ++pos) {
+    if (pattern[pos] == ':' && pattern[pos - 1] == '/') {
+      size_t end = pattern.find('/', pos);
+      if (end == std::string::npos)
+        end = pattern.length();
+      route.param_names.push_back(pattern.substr(pos + 1, end - pos - 1));
+    }
+  }
+  if (route.param_names.size() > ROUTER_MAX_PARAMS) {
+    fprintf(stderr, "Too many parameters in route %s\n", pattern.c_str());
+    throw std::exception();
+  }
+
+  for (size_t i = 0; i < routes.size(); ++i) {
+    if (routes[i].pattern == pattern) {
+      routes[i] = route;
+      return;
+    }
+  }
+  routes.push_back(route);
+}
+
+void Router::Compile() {
+  // a fresh copy, so that compiling again after a NUMA binding leaves
+  // every table a request reads in the caller's memory
+  std::vector<Route>(routes).swap(routes);
+
+  BuildNode root;
+  for (size_t i = 0; i < routes.size(); ++i) {
+    const std::string& pattern = routes[i].pattern;
+    BuildNode* node = &root;
+    size_t pos = 0;
+    while (pos < pattern.length()) {
+      if (pattern[pos] == '*' && pos + 1 == pattern.length())
+        break;
+      if (pattern[pos] == ':' && pattern[pos - 1] == '/') {
+        if (node->param == NULL)
+          node->param = new BuildNode;
+        node = node->param;
+        pos = pattern.find('/', pos);
+        if (pos == std::string::npos)
+          pos = pattern.length();
+        continue;
+      }
+      BuildNode*& child = node->children[pattern[pos]];
+      if (child == NULL)
+        child = new BuildNode;
+      node = child;
+      ++pos;
+    }
+    if (pos < pattern.length())
+      node->prefix_route = i;
+    else
+      node->exact_route = i;
+  }
+
+  // Breadth first, so the children of a node get consecutive slots; runs
+  // of single-child nodes collapse into one label.
+  struct Pending {
+    BuildNode* build;
+    int index;
+    char first;
+  };
+  std::vector<Node>().swap(nodes);
+  std::string().swap(labels);
+  std::deque<Pending> queue;
+  Pending top = { &root, 0, '\0' };
+  nodes.push_back(Node());
+  queue.push_back(top);
+  while (!queue.empty()) {
+    Pending pending = queue.front();
+    queue.pop_front();
+
+    BuildNode* build = pending.build;
+    std::string label;
+    if (pending.first != '\0') {
+      label += pending.first;
+      while (build->children.size() == 1 && build->param == NULL &&
+             build->exact_route == -1 && build->prefix_route == -1) {
+        label += build->children.begin()->first;
+        build = build->children.begin()->second;
+      }
+    }
+
+    Node node;
+    node.label = labels.length();
+    node.label_length = label.length();
+    labels += label;
+    node.num_children = build->children.size();
+    node.first_child = nodes.size();
+    node.param_child = -1;
+    node.exact_route = build->exact_route;
+    node.prefix_route = build->prefix_route;
+
+    for (std::map<char, BuildNode*>::iterator it = build->children.begin();
+         it != build->children.end(); ++it) {
+      Pending child = { it->second, (int)nodes.size(), it->first };
+      queue.push_back(child);
+      nodes.push_back(Node());
+    }
+    if (build->param != NULL) {
+      Pending child = { build->param, (int)nodes.size(), '\0' };
+      node.param_child = nodes.size();
+      queue.push_back(child);
+      nodes.push_back(Node());
+    }
+    nodes[pending.index] = node;
+  }
+}
+
+bool Router::MatchNode(int index, const char* p, const char* end,
+                       RouteMatch* match, PrefixMatch* prefix) const {
+  const Node& node = nodes[index];
+  if (node.prefix_route != -1 && (prefix->route == -1 || p > prefix->end)) {
+    prefix->route = node.prefix_route;
+    prefix->end = p;
+    prefix->num_params = match->num_params;
+    for (int i = 0; i < match->num_params; ++i) {
+      prefix->params[i] = match->params[i];
+      prefix->param_lengths[i] = match->param_lengths[i];
+    }
+  }
+  if (p == end) {
+    if (node.exact_route == -1)
+      return false;
+    match->route = node.exact_route;
+    return true;
+  }
+
+  const Node* child = &nodes[node.first_child];
+  for (int i = 0; i < node.num_children; ++i, ++child) {
+    const char* label = labels.data() + child->label;
+    if (label[0] != *p)
+      continue;
+    if (child->label_length <= end - p &&
+        memcmp(label, p, child->label_length) == 0 &&
+        MatchNode(node.first_child + i, p + child->label_length, end, match,
+                  prefix))
+      return true;
+    break;
+  }
+
+  if (node.param_child != -1 && *p != '/' &&
+      match->num_params < ROUTER_MAX_PARAMS) {
+    const char* segment_end = (const char*)memchr(p, '/', end - p);
+    if (segment_end == NULL)
+      segment_end = end;
+    int n = match->num_params++;
+    match->params[n] = p;
+    match->param_lengths[n] = segment_end - p;
+    if (MatchNode(node.param_child, segment_end, end, match, prefix))
+      return true;
+    --match->num_params;
+  }
+  return false;
+}
+
+bool Router::Match(const std::string& uri, RouteMatch* match) const {
+  // the path, without the query; an absolute-form URI has its scheme and
+  // authority skipped, and only a "://" ahead of any '/' or '?' makes one
+  const char* p = uri.c_str();
+  const char* end = p + uri.length();
+  if (*p != '/') {
+    size_t scheme = uri.find("://");
+    if (scheme == std::string::npos ||
+        scheme > uri.find_first_of("/?"))
+      return false;
+    p += scheme + 3;
+  }
+  p = (const char*)memchr(p, '/', end - p);
+  if (p == NULL)
+    return false;
+  const char* query = (const char*)memchr(p, '?', end - p);
+  if (query != NULL)
+    end = query;
+  match->path = p;
+  match->path_length = end - p;
+
+  PrefixMatch prefix;
+  prefix.route = -1;
+  match->num_params = 0;
+  if (!MatchNode(0, p, end, match, &prefix)) {
+    if (prefix.route == -1)
+      return false;
+    match->route = prefix.route;
+    match->num_params = prefix.num_params;
+    for (int i = 0; i < prefix.num_params; ++i) {
+      match->params[i] = prefix.params[i];
+      match->param_lengths[i] = prefix.param_lengths[i];
+    }
+  }
+
+  const Route& route = routes[match->route];
+  for (int i = 0; i < match->num_params; ++i)
+    match->param_names[i] = route.param_names[i].c_str();
+  return true;
+}
+
+bool Router::Dispatch(HttpRequest* req, int fd, const std::string& http_mode,
+                      bool keep_alive, SendPacer* pacer) const {
+  ResponseWriter response(fd, *req, http_mode, keep_alive, pacer);
+  RouteMatch match;
+  if (req->bad)
+    response.SendStatus("400 Bad Request");
+  else if (!Match(req->uri, &match))
+    response.SendStatus("404 Not Found");
+  else
+    routes[match.route].handler->Handle(*req, match, &response);
+
+  bool open = response.Finish();
+  req->trans_time = response.TransferMicros();
+  return open;
+}
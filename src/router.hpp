@@ -0,0 +1,179 @@
+/*
+ * router.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROUTER_HPP_
+#define ROUTER_HPP_
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#define ROUTER_MAX_PARAMS 8
+
+class ContentCache;
+class HotPaths;
+struct HttpRequest;
+class SendPacer;
+
+// The route a path matched, with the values of its :name segments as
+// pointers into the request's URI.
+struct RouteMatch {
+  int route;
+  // the path matched: the URI's, without scheme, authority or query
+  const char* path;
+  size_t path_length;
+  int num_params;
+  const char* param_names[ROUTER_MAX_PARAMS];
+  const char* params[ROUTER_MAX_PARAMS];
+  size_t param_lengths[ROUTER_MAX_PARAMS];
+
+  // Value of the segment named |name| ("id" for ":id"), or "".
+  std::string Param(const char* name) const;
+};
+
+// Writes one response.  Headers are held back until the first body
+// bytes so small responses leave in a single write.  Bodies passed to
+// Write are streamed with chunked encoding, or close-delimited to
+// clients that don't understand it; SendFile sends a whole file with
+// Content-Length.
+class ResponseWriter {
+ public:
+  // |keep_alive| false closes the connection after this response even
+  // where it could be reused.  File bodies are sent a quantum at a time
+  // within |pacer|'s rate caps, if given.
+  ResponseWriter(int fd, const HttpRequest& req, const std::string& http_mode,
+                 bool keep_alive, SendPacer* pacer = NULL);
+
+  void SetStatus(const std::string& status);
+  void AddHeader(const std::string& name, const std::string& value);
+
+  void Write(const char* data, size_t length);
+  void Write(const std::string& s);
+  void SendFile(int file, off_t size);
+  // A whole body from memory, with Content-Length.
+  void SendBody(const char* data, size_t size);
+  // A complete response with this status and no body.
+  void SendStatus(const std::string& status);
+
+  // Ends the response; closes the connection unless it can be reused.
+  // Returns whether it was kept open.
+  bool Finish();
+
+  long TransferMicros() const;
+  int GetFd() const;
+
+ private:
+  int fd;
+  const std::string& http_version;
+  const std::string& http_mode;
+  bool head_only;
+  std::string status;
+  std::string out;
+  bool headers_sent;
+  bool chunked;
+  bool keep_alive;
+  SendPacer* pacer;
+  bool fixed_length;
+  bool finished;
+  off_t body_bytes;
+  timeval start;
+  long transfer_micros;
+
+  void SendHeaders(const char* framing, size_t body_length);
+  void Flush();
+};
+
+class HttpHandler {
+ public:
+  virtual ~HttpHandler() {}
+  virtual void Handle(const HttpRequest& req, const RouteMatch& match,
+                      ResponseWriter* response) = 0;
+};
+
+// Serves GET and HEAD from files under a root directory, counting the
+// files served in |hot_paths| and keeping the bodies of small ones in
+// |cache|, if given.
+class StaticFileHandler : public HttpHandler {
+ public:
+  StaticFileHandler(const std::string& http_root, HotPaths* hot_paths,
+                    ContentCache* cache = NULL);
+  void Handle(const HttpRequest& req, const RouteMatch& match,
+              ResponseWriter* response);
+
+ private:
+  std::string http_root;
+  HotPaths* hot_paths;
+  ContentCache* cache;
+};
+
+// Maps paths to handlers.  A pattern is exact ("/health"), a prefix
+// ending in "*" ("/static/*"), and may have ":name" segments
+// ("/users/:id/posts").  Full matches win over prefixes and static
+// segments over parameters; the longest prefix wins among prefixes.
+// Compile() lays the patterns out as a radix trie in one array, with each
+// node's children next to each other, and Match() walks it without
+// allocating.
+class Router {
+ public:
+  Router();
+
+  // Registers or replaces |pattern|.  Takes effect at the next Compile().
+  void Handle(const std::string& pattern, HttpHandler* handler);
+  void Compile();
+
+  bool Match(const std::string& uri, RouteMatch* match) const;
+
+  // Answers |req| with the handler its path matches, or 400 or 404.
+  // Returns false when the connection was closed.
+  bool Dispatch(HttpRequest* req, int fd, const std::string& http_mode,
+                bool keep_alive, SendPacer* pacer = NULL) const;
+
+ private:
+  struct Route {
+    std::string pattern;
+    HttpHandler* handler;
+    std::vector<std::string> param_names;
+  };
+
+  struct Node {
+    uint32_t label;
+    uint16_t label_length;
+    uint16_t num_children;
+    uint32_t first_child;
+    int32_t param_child;
+    int16_t exact_route;
+    int16_t prefix_route;
+  };
+
+  struct PrefixMatch;
+
+  std::vector<Route> routes;
+  std::vector<Node> nodes;
+  std::string labels;
+
+  bool MatchNode(int index, const char* p, const char* end, RouteMatch* match,
+                 PrefixMatch* prefix) const;
+};
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * tls.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <exception>
+#include <string>
+
+#ifdef HAVE_OPENSSL_SSL_H
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+#include "tls.hpp"
+
+#define TLS_RELAY_BUFFER 16384
+
+#ifdef HAVE_OPENSSL_SSL_H
+
+TlsContext::TlsContext(const std::string& cert_file,
+                       const std::string& key_file,
+                       const std::string& max_version) {
+  int version = 0;
+  if (max_version == "1.2") {
+    version = TLS1_2_VERSION;
+  } else if (max_version == "1.3") {
+    version = TLS1_3_VERSION;
+  } else if (!max_version.empty()) {
+    fprintf(stderr, "Invalid TLS version %s\n", max_version.c_str());
+    throw std::exception();
+  }
+
+  ctx = SSL_CTX_new(TLS_server_method());
+  if (ctx == NULL) {
+    ERR_print_errors_fp(stderr);
+    throw std::exception();
+  }
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_max_proto_version(ctx, version);
+
+  if (SSL_CTX_use_certificate_chain_file(ctx, cert_file.c_str()) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx, key_file.c_str(),
+                                  SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(ctx) != 1) {
+    fprintf(stderr, "Unable to load TLS certificate %s and key %s\n",
+            cert_file.c_str(), key_file.c_str());
+    ERR_print_errors_fp(stderr);
+    SSL_CTX_free(ctx);
+    throw std::exception();
+  }
+
+  // Stateless resumption: the ticket keys live in the context, which the
+  // worker processes inherit, so no session cache has to be shared.
+  static const unsigned char session_id_context[] = "myhttpd";
+  SSL_CTX_set_session_id_context(ctx, session_id_context,
+                                 sizeof(session_id_context) - 1);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_set_num_tickets(ctx, 1);
+
+  // let OpenSSL install the session keys with TCP_ULP "tls" when it can
+#ifdef SSL_OP_ENABLE_KTLS
+  SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+  // a record holding only a ticket or key update shouldn't block the relay
+  SSL_CTX_clear_mode(ctx, SSL_MODE_AUTO_RETRY);
+}
+
+TlsContext::~TlsContext() {
+  SSL_CTX_free(ctx);
+}
+
+TlsConnection::TlsConnection(TlsContext* context, int fd)
+    : ssl(NULL), fd(fd), relay_fd(-1), kernel_tls(false), relaying(false) {
+  ssl = SSL_new(context->ctx);
+  if (ssl == NULL) {
+    ERR_print_errors_fp(stderr);
+    throw std::exception();
+  }
+  SSL_set_fd(ssl, fd);
+}
+
+TlsConnection::~TlsConnection() {
+  if (relaying)
+    pthread_join(relay, NULL);
+  SSL_free(ssl);
+  // with kernel TLS the HTTP code owns and closes the socket
+  if (!kernel_tls)
+    close(fd);
+}
+
+int TlsConnection::Handshake() {
+  if (SSL_accept(ssl) != 1) {
+    ERR_clear_error();
+    return -1;
+  }
+
+#ifdef SSL_OP_ENABLE_KTLS
+  if (BIO_get_ktls_send(SSL_get_wbio(ssl)) &&
+      BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+    kernel_tls = true;
+    return fd;
+  }
+#endif
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+    perror("socketpair");
+    return -1;
+  }
+  relay_fd = fds[1];
+  if (pthread_create(&relay, NULL, RunRelay, this) != 0) {
+    perror("pthread_create");
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  relaying = true;
+  return fds[0];
+}
+
+void* TlsConnection::RunRelay(void* arg) {
+  ((TlsConnection*)arg)->Relay();
+  return NULL;
+}
+
+void TlsConnection::Relay() {
+  char buf[TLS_RELAY_BUFFER];
+  // decrypted bytes the HTTP side hasn't taken yet
+  std::string to_app;
+  bool app_closed = false;
+
+  while (true) {
+    pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = to_app.empty() ? POLLIN : 0;
+    fds[0].revents = 0;
+    fds[1].fd = relay_fd;
+    fds[1].events = POLLIN | (to_app.empty() ? 0 : POLLOUT);
+    fds[1].revents = 0;
+    if (!to_app.empty() || SSL_pending(ssl) == 0) {
+      if (poll(fds, 2, -1) == -1) {
+        if (errno == EINTR)
+          continue;
+        perror("poll");
+        break;
+      }
+    }
+
+    if (to_app.empty() &&
+        (SSL_pending(ssl) > 0 || (fds[0].revents & (POLLIN | POLLHUP |
+                                                     POLLERR)))) {
+      int numread = SSL_read(ssl, buf, sizeof(buf));
+      if (numread > 0) {
+        to_app.assign(buf, numread);
+      } else {
+        int error = SSL_get_error(ssl, numread);
+        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+          break;
+      }
+    }
+
+    if (!to_app.empty()) {
+      ssize_t cnt = send(relay_fd, to_app.data(), to_app.length(),
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (cnt == -1 && errno != EAGAIN && errno != EINTR)
+        break;
+      if (cnt > 0)
+        to_app.erase(0, cnt);
+    }
+
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t numread = recv(relay_fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (numread == 0 || (numread == -1 && errno != EAGAIN &&
+                           errno != EINTR)) {
+        app_closed = true;
+        break;
+      }
+      if (numread > 0 && SSL_write(ssl, buf, numread) <= 0)
+        break;
+    }
+  }
+
+  if (app_closed)
+    SSL_shutdown(ssl);
+  ERR_clear_error();
+  close(relay_fd);
+}
+
+#else
+
+TlsContext::TlsContext(const std::string& cert_file,
+                       const std::string& key_file,
+                       const std::string& max_version) : ctx(NULL) {
+  fprintf(stderr, "Built without TLS support\n");
+  throw std::exception();
+}
+
+TlsContext::~TlsContext() {
+}
+
+TlsConnection::TlsConnection(TlsContext* context, int fd)
+    : ssl(NULL), fd(fd), relay_fd(-1), kernel_tls(false), relaying(false) {
+}
+
+TlsConnection::~TlsConnection() {
+  close(fd);
+}
+
+int TlsConnection::Handshake() {
+  return -1;
+}
+
+void* TlsConnection::RunRelay(void* arg) {
+  return NULL;
+}
+
+void TlsConnection::Relay() {
+}
+
+#endif
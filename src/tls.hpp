@@ -0,0 +1,76 @@
+/*
+ * tls.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TLS_HPP_
+#define TLS_HPP_
+
+#include <pthread.h>
+
+#include <string>
+
+struct ssl_ctx_st;
+struct ssl_st;
+
+// Server-side TLS state shared by all connections: certificate, key and
+// the session ticket keys.  Created before the server forks, so every
+// worker process can resume sessions issued by any other.  |max_version|
+// caps the protocol at "1.2" or "1.3", or is empty for no cap.
+class TlsContext {
+ public:
+  TlsContext(const std::string& cert_file, const std::string& key_file,
+             const std::string& max_version);
+  ~TlsContext();
+
+ private:
+  friend class TlsConnection;
+  ssl_ctx_st* ctx;
+};
+
+// One TLS connection on an accepted socket.  Handshake() returns the
+// descriptor the HTTP code should use: the socket itself once the session
+// keys are in kernel TLS for both directions, so plain read, write and
+// sendfile get encrypted by the kernel; otherwise one end of a socketpair
+// whose other end a relay thread pumps through OpenSSL.  The destructor
+// waits for the relay to finish.
+//
+// OpenSSL 3.0 offloads receive only for TLS 1.2, so TLS 1.3 sessions
+// always take the relay there; capping the context at 1.2 trades the
+// newer protocol for zero-copy sendfile.
+class TlsConnection {
+ public:
+  TlsConnection(TlsContext* context, int fd);
+  ~TlsConnection();
+
+  int Handshake();
+
+ private:
+  ssl_st* ssl;
+  int fd;
+  int relay_fd;
+  bool kernel_tls;
+  bool relaying;
+  pthread_t relay;
+
+  static void* RunRelay(void* arg);
+  void Relay();
+};
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * topology.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "topology.hpp"
+
+#define NUMA_SYSFS "/sys/devices/system/node"
+#define NUMA_MAX_NODES 1024
+// from <numaif.h>, to avoid depending on libnuma
+#define NUMA_MPOL_BIND 2
+
+namespace {
+
+// Parses a sysfs CPU list such as "0-3,8-11".
+bool ParseCpuList(const char* list, cpu_set_t* cpus) {
+  CPU_ZERO(cpus);
+  const char* p = list;
+  while (*p != '\0' && *p != '\n') {
+    char* end;
+    long first = strtol(p, &end, 10);
+    if (end == p)
+      return false;
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1)
+        return false;
+      p = end;
+    }
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+      CPU_SET(cpu, cpus);
+    if (*p == ',')
+      ++p;
+  }
+  return true;
+}
+
+bool ReadNode(int id, NumaNode* node) {
+  char path[128];
+  snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/cpulist", id);
+  FILE* file = fopen(path, "r");
+  if (file == NULL)
+    return false;
+  char list[4096];
+  bool ok = fgets(list, sizeof(list), file) != NULL &&
+      ParseCpuList(list, &node->cpus);
+  fclose(file);
+  node->id = id;
+  node->num_cpus = CPU_COUNT(&node->cpus);
+  // memory-only nodes have no CPUs to run a worker on
+  return ok && node->num_cpus > 0;
+}
+
+bool ById(const NumaNode& a, const NumaNode& b) {
+  return a.id < b.id;
+}
+
+}
+
+std::vector<NumaNode> ReadNumaTopology() {
+  std::vector<NumaNode> nodes;
+  DIR* dir = opendir(NUMA_SYSFS);
+  if (dir != NULL) {
+    dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+      int id;
+      char rest;
+      if (sscanf(entry->d_name, "node%d%c", &id, &rest) != 1)
+        continue;
+      NumaNode node;
+      if (ReadNode(id, &node))
+        nodes.push_back(node);
+    }
+    closedir(dir);
+  }
+  std::sort(nodes.begin(), nodes.end(), ById);
+
+  if (nodes.empty()) {
+    NumaNode node;
+    node.id = -1;
+    if (sched_getaffinity(0, sizeof(node.cpus), &node.cpus) == -1) {
+      CPU_ZERO(&node.cpus);
+      CPU_SET(0, &node.cpus);
+    }
+    node.num_cpus = CPU_COUNT(&node.cpus);
+    nodes.push_back(node);
+  }
+  return nodes;
+}
+
+bool BindToNumaNode(const NumaNode& node) {
+  bool ok = true;
+  if (sched_setaffinity(0, sizeof(node.cpus), &node.cpus) == -1) {
+    perror("sched_setaffinity");
+    ok = false;
+  }
+  if (node.id < 0 || node.id >= NUMA_MAX_NODES)
+    return ok;
+
+  unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+  memset(mask, 0, sizeof(mask));
+  mask[node.id / (8 * sizeof(unsigned long))] |=
+      1UL << (node.id % (8 * sizeof(unsigned long)));
+  if (syscall(SYS_set_mempolicy, NUMA_MPOL_BIND, mask,
+              (unsigned long)NUMA_MAX_NODES + 1) == -1) {
+    // ENOSYS and EPERM in containers and on kernels without NUMA
+    if (errno != ENOSYS && errno != EPERM)
+      perror("set_mempolicy");
+    ok = false;
+  }
+  return ok;
+}
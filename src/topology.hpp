@@ -0,0 +1,43 @@
+/*
+ * topology.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TOPOLOGY_HPP_
+#define TOPOLOGY_HPP_
+
+#include <sched.h>
+
+#include <vector>
+
+// NUMA layout read from /sys/devices/system/node.  Machines without it
+// look like a single node holding every CPU.
+struct NumaNode {
+  int id;
+  cpu_set_t cpus;
+  int num_cpus;
+};
+
+std::vector<NumaNode> ReadNumaTopology();
+
+// Restricts the calling process to |node|'s CPUs and binds its future
+// memory allocations to the node.  Returns false if either failed.
+bool BindToNumaNode(const NumaNode& node);
+
+#endif
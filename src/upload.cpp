@@ -0,0 +1,356 @@
+/*
+ * upload.cpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <string>
+
+#include "http_request.hpp"
+#include "probes.hpp"
+#include "upload.hpp"
+
+#define UPLOAD_PIPE_SIZE (1 << 20)
+#define UPLOAD_BUFFER_SIZE 16384
+#define UPLOAD_MAX_LINE 4096
+
+// Outcome of moving body bytes that isn't an HTTP status: the client went
+// away or stopped sending, so there's nobody to answer.
+#define UPLOAD_CONNECTION_LOST -1
+
+namespace {
+
+// Where body bytes go: the temporary file, filled from what was already
+// read past the headers and then straight from the socket.
+struct BodySink {
+  int fd;
+  std::string* pending;
+  int file;
+  int pipe[2];
+  bool splice;
+  long long received;
+};
+
+const char* StatusLine(int status) {
+  switch (status) {
+    case 201: return "201 Created";
+    case 204: return "204 No Content";
+    case 400: return "400 Bad Request";
+    case 403: return "403 Forbidden";
+    case 404: return "404 Not Found";
+    case 411: return "411 Length Required";
+    case 413: return "413 Payload Too Large";
+    case 501: return "501 Not Implemented";
+    case 507: return "507 Insufficient Storage";
+    default: return "500 Internal Server Error";
+  }
+}
+
+bool WriteAll(int file, const char* data, size_t length) {
+  while (length > 0) {
+    ssize_t cnt = write(file, data, length);
+    if (cnt == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += cnt;
+    length -= cnt;
+  }
+  return true;
+}
+
+int DiskError() {
+  int error_num = errno;
+  if (error_num == ENOSPC || error_num == EDQUOT)
+    return 507;
+  perror("upload");
+  return 500;
+}
+
+// Copies with read and write when the socket can't be spliced from (a
+// TLS relay on an old kernel, say).
+int CopyBody(BodySink* sink, long long length) {
+  char buf[UPLOAD_BUFFER_SIZE];
+  while (length > 0) {
+    ssize_t numread = read(sink->fd, buf, std::min(length,
+                                                   (long long)sizeof(buf)));
+    if (numread == -1 && errno == EINTR)
+      continue;
+    if (numread <= 0)
+      return UPLOAD_CONNECTION_LOST;
+    if (!WriteAll(sink->file, buf, numread))
+      return DiskError();
+    length -= numread;
+    sink->received += numread;
+  }
+  return 0;
+}
+
+// Moves exactly |length| body bytes into the file.
+int MoveBody(BodySink* sink, long long length) {
+  if (!sink->pending->empty()) {
+    size_t n = std::min((long long)sink->pending->length(), length);
+    if (!WriteAll(sink->file, sink->pending->data(), n))
+      return DiskError();
+    sink->pending->erase(0, n);
+    length -= n;
+    sink->received += n;
+  }
+
+  while (length > 0 && sink->splice) {
+    ssize_t in = splice(sink->fd, NULL, sink->pipe[1], NULL,
+                        std::min(length, (long long)UPLOAD_PIPE_SIZE),
+                        SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (in == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EINVAL) {
+        sink->splice = false;
+        break;
+      }
+      return UPLOAD_CONNECTION_LOST;
+    }
+    if (in == 0)
+      return UPLOAD_CONNECTION_LOST;
+
+    for (ssize_t left = in; left > 0; ) {
+      ssize_t out = splice(sink->pipe[0], NULL, sink->file, NULL, left,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (out == -1) {
+        if (errno == EINTR)
+          continue;
+        return DiskError();
+      }
+      left -= out;
+    }
+    length -= in;
+    sink->received += in;
+  }
+
+  if (length > 0)
+    return CopyBody(sink, length);
+  return 0;
+}
+
+// Reads one CRLF terminated line of the chunked framing into |line|.
+int ReadLine(BodySink* sink, std::string* line) {
+  std::string* pending = sink->pending;
+  size_t from = 0;
+  size_t end;
+  while ((end = pending->find("\r\n", from)) == std::string::npos) {
+    if (pending->length() > UPLOAD_MAX_LINE)
+      return 400;
+    from = pending->empty() ? 0 : pending->length() - 1;
+    char buf[UPLOAD_MAX_LINE];
+    ssize_t numread = read(sink->fd, buf, sizeof(buf));
+    if (numread == -1 && errno == EINTR)
+      continue;
+    if (numread <= 0)
+      return UPLOAD_CONNECTION_LOST;
+    pending->append(buf, numread);
+  }
+  line->assign(*pending, 0, end);
+  pending->erase(0, end + 2);
+  return 0;
+}
+
+int ReceiveChunked(BodySink* sink, long long max_bytes) {
+  std::string line;
+  while (true) {
+    int status = ReadLine(sink, &line);
+    if (status != 0)
+      return status;
+
+    char* end;
+    errno = 0;
+    long long size = strtoll(line.c_str(), &end, 16);
+    if (end == line.c_str() || (*end != '\0' && *end != ';' && *end != ' ') ||
+        size < 0 || errno == ERANGE)
+      return 400;
+    if (size == 0)
+      break;
+    if (size > max_bytes - sink->received)
+      return 413;
+
+    status = MoveBody(sink, size);
+    if (status != 0)
+      return status;
+    status = ReadLine(sink, &line);
+    if (status != 0)
+      return status;
+    if (!line.empty())
+      return 400;
+  }
+
+  // trailer fields are dropped
+  do {
+    int status = ReadLine(sink, &line);
+    if (status != 0)
+      return status;
+  } while (!line.empty());
+  return 0;
+}
+
+// True if a segment of |path| is "..", which could write outside the root.
+bool HasDotDot(const std::string& path) {
+  size_t begin = 0;
+  while (begin < path.length()) {
+    size_t end = path.find('/', begin);
+    if (end == std::string::npos)
+      end = path.length();
+    if (path.compare(begin, end - begin, "..") == 0)
+      return true;
+    begin = end + 1;
+  }
+  return false;
+}
+
+bool Answer(int fd, const HttpRequest& req, const std::string& http_mode,
+            int status, bool keep_open) {
+  std::string head = http_mode + " " + StatusLine(status) + "\r\n";
+  if (status != 204)
+    head += "Content-Length: 0\r\n";
+  if (!keep_open) {
+    Write(fd, head + "Connection: close\r\n\r\n");
+    HTTPD_PROBE1(headers__sent, fd);
+    HTTPD_PROBE1(connection__close, fd);
+    close(fd);
+    return false;
+  }
+  Write(fd, head);
+  EndHeaders(fd, req.http_mode, http_mode);
+  return EndResponse(fd, http_mode) && http_mode != "HTTP/1.0";
+}
+
+}
+
+UploadHandler::UploadHandler(long long max_bytes) : max_bytes(max_bytes) {
+}
+
+bool UploadHandler::Handle(const HttpRequest& req, int fd,
+                           std::string* pending, const std::string& http_root,
+                           const std::string& http_mode) {
+  std::string path;
+  try {
+    path = PathFromUri(req.uri);
+  } catch (std::exception&) {
+    return Answer(fd, req, http_mode, 400, false);
+  }
+  path = ReplaceString(path, std::string("%20"), " ");
+  if (path[path.length() - 1] == '/' || HasDotDot(path))
+    return Answer(fd, req, http_mode, 403, false);
+  path = http_root + path;
+
+  // the body isn't read on any of the early answers, so they all close
+  bool chunked = false;
+  long long length = 0;
+  std::string transfer_encoding = req.GetHeader("Transfer-Encoding");
+  std::string content_length = req.GetHeader("Content-Length");
+  if (!transfer_encoding.empty()) {
+    if (!EqualsIgnoreCase(transfer_encoding, "chunked"))
+      return Answer(fd, req, http_mode, 501, false);
+    chunked = true;
+  } else if (!content_length.empty()) {
+    char* end;
+    errno = 0;
+    length = strtoll(content_length.c_str(), &end, 10);
+    if (*end != '\0' || end == content_length.c_str() || length < 0 ||
+        errno == ERANGE)
+      return Answer(fd, req, http_mode, 400, false);
+  } else {
+    return Answer(fd, req, http_mode, 411, false);
+  }
+  if (length > max_bytes)
+    return Answer(fd, req, http_mode, 413, false);
+
+  struct stat statbuf;
+  bool exists = stat(path.c_str(), &statbuf) == 0;
+  if (exists && !S_ISREG(statbuf.st_mode))
+    return Answer(fd, req, http_mode, 403, false);
+
+  std::string temp_path = path.substr(0, path.rfind('/') + 1) +
+      ".upload-XXXXXX";
+  BodySink sink;
+  sink.file = mkstemp(&temp_path[0]);
+  if (sink.file == -1) {
+    int error_num = errno;
+    return Answer(fd, req, http_mode,
+                  error_num == ENOENT || error_num == ENOTDIR ? 404 :
+                  error_num == EACCES ? 403 : DiskError(), false);
+  }
+  fcntl(sink.file, F_SETFD, FD_CLOEXEC);
+  fchmod(sink.file, 0644);
+
+  if (pipe2(sink.pipe, O_CLOEXEC) == -1) {
+    int status = DiskError();
+    close(sink.file);
+    unlink(temp_path.c_str());
+    return Answer(fd, req, http_mode, status, false);
+  }
+  fcntl(sink.pipe[1], F_SETPIPE_SZ, UPLOAD_PIPE_SIZE);
+  sink.fd = fd;
+  sink.pending = pending;
+  sink.splice = true;
+  sink.received = 0;
+
+  int status = 0;
+  try {
+    if (EqualsIgnoreCase(req.GetHeader("Expect"), "100-continue") &&
+        req.http_mode == "HTTP/1.1")
+      Write(fd, "HTTP/1.1 100 Continue\r\n\r\n");
+    if (chunked)
+      status = ReceiveChunked(&sink, max_bytes);
+    else
+      status = MoveBody(&sink, length);
+  } catch (int) {
+    status = UPLOAD_CONNECTION_LOST;
+  }
+  close(sink.pipe[0]);
+  close(sink.pipe[1]);
+  if (close(sink.file) == -1 && status == 0)
+    status = DiskError();
+
+  if (status == 0 && rename(temp_path.c_str(), path.c_str()) == -1)
+    status = DiskError();
+  if (status != 0) {
+    unlink(temp_path.c_str());
+    if (status == UPLOAD_CONNECTION_LOST) {
+      HTTPD_PROBE1(connection__close, fd);
+      close(fd);
+      return false;
+    }
+    // the rest of a rejected body is still unread
+    return Answer(fd, req, http_mode, status, false);
+  }
+  HTTPD_PROBE2(body__complete, fd, (long)sink.received);
+
+  return Answer(fd, req, http_mode, exists ? 204 : 201, true);
+}
@@ -0,0 +1,47 @@
+/*
+ * upload.hpp
+ *
+ * Copyright (C) 2013 Baharak Saberidokht <baharak1364@gmail.com>
+ *
+ * This file is part of Http Server.
+ *
+ * Http Server is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * Http Server is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Http Server. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UPLOAD_HPP_
+#define UPLOAD_HPP_
+
+#include <string>
+
+struct HttpRequest;
+
+// Stores PUT and POST bodies as files under http_root.  The body is
+// spliced from the socket through a pipe into a temporary file next to
+// the target, which is renamed over it once the body is complete, so
+// memory use doesn't grow with the size of the upload and readers never
+// see a partial file.
+class UploadHandler {
+ public:
+  explicit UploadHandler(long long max_bytes);
+
+  // Receives the body of |req| (Content-Length or chunked) and answers
+  // 201 or 204.  Returns false when the client connection was closed.
+  bool Handle(const HttpRequest& req, int fd, std::string* pending,
+              const std::string& http_root, const std::string& http_mode);
+
+ private:
+  long long max_bytes;
+};
+
+#endif